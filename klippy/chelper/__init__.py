@@ -18,7 +18,8 @@ COMPILE_ARGS = ("-Wall -g -O2 -shared -fPIC"
 SSE_FLAGS = "-mfpmath=sse -msse2"
 SOURCE_FILES = [
     'pyhelper.c', 'serialqueue.c', 'stepcompress.c', 'itersolve.c', 'trapq.c',
-    'pollreactor.c', 'msgblock.c', 'trdispatch.c',
+    'pollreactor.c', 'msgblock.c', 'trdispatch.c', 'gcodeparse.c',
+    'gcodearc.c', 'sensorparse.c', 'bedmesh.c',
     'kin_cartesian.c', 'kin_corexy.c', 'kin_corexz.c', 'kin_delta.c',
     'kin_polar.c', 'kin_rotary_delta.c', 'kin_winch.c', 'kin_extruder.c',
     'kin_shaper.c',
@@ -192,6 +193,85 @@ defs_trdispatch = """
         , uint64_t expire_ticks, uint64_t min_extend_ticks);
 """
 
+defs_msgcodec = """
+    struct msgcodec *msgcodec_alloc(void);
+    void msgcodec_free(struct msgcodec *mc);
+    int msgcodec_add_format(struct msgcodec *mc, int msgid
+        , const char *param_types);
+    int msgcodec_encode(struct msgcodec *mc, int msgid, int64_t *params
+        , int count, uint8_t *out);
+    int msgcodec_decode(struct msgcodec *mc, uint8_t *msg, int msg_len
+        , int64_t *params, int max_params);
+"""
+
+defs_gcodeparse = """
+    struct gcode_params {
+        uint32_t mask;
+        double values[26];
+    };
+
+    int gcode_parse_move(struct gcode_params *gp, const char *line);
+    int gcode_decode_move(struct gcode_params *gp, const uint8_t *data
+        , int len);
+"""
+
+defs_gcodearc = """
+    int gcode_arc_plan(const double *start, const double *target
+        , double offset_i, double offset_j, int clockwise
+        , double mm_per_segment, double chord_tolerance
+        , double *out, int max_segments);
+"""
+
+defs_sensorparse = """
+    struct adxl345_decode {
+        int axes_pos[3];
+        double axes_scale[3];
+        double time_base, chip_base, inv_freq;
+        int64_t last_sequence, last_chip_clock;
+        uint32_t error_count;
+    };
+
+    int adxl345_decode_samples(struct adxl345_decode *ad
+        , const uint8_t *data, const uint16_t *sequences, const int *lengths
+        , int msg_count, double *out, int max_samples);
+    int adxl345_decode_delta_samples(struct adxl345_decode *ad
+        , const uint8_t *data, const uint16_t *sequences, const int *lengths
+        , int msg_count, double *out, int max_samples);
+
+    int angle_decode_delta(const uint8_t *data, int len, uint8_t *tcodes
+        , uint16_t *raw_angles);
+
+    struct angle_decode {
+        int64_t start_clock, sample_ticks, last_sequence, last_angle;
+        int64_t last_chip_mcu_clock, last_chip_clock;
+        double chip_freq, clock_offset, clock_freq, static_delay;
+        int time_shift, is_tcode_absolute, is_delta_encoded;
+        int has_calibration, calibration_reversed;
+        int32_t calibration[65];
+        uint32_t error_count;
+    };
+
+    int angle_decode_samples(struct angle_decode *ad
+        , const uint8_t *data, const uint16_t *sequences, const int *lengths
+        , int msg_count, double *times, int64_t *angles, int max_samples);
+"""
+
+defs_bedmesh = """
+    struct bed_mesh *bed_mesh_alloc(int x_count, int y_count);
+    void bed_mesh_free(struct bed_mesh *bm);
+    void bed_mesh_set_geometry(struct bed_mesh *bm, double x_min
+        , double x_dist, double y_min, double y_dist);
+    void bed_mesh_set_row(struct bed_mesh *bm, int row
+        , const double *z_values);
+    void bed_mesh_set_offsets(struct bed_mesh *bm, double x_offset
+        , double y_offset);
+    double bed_mesh_calc_z(struct bed_mesh *bm, double x, double y);
+    int bed_mesh_split_move(struct bed_mesh *bm, const double *prev
+        , const double *next, double factor, double fade_offset
+        , double split_delta_z, double move_check_distance
+        , double *out, int max_moves);
+"""
+
 defs_pyhelper = """
     void set_python_logging_callback(void (*func)(const char *));
     double get_monotonic(void);
@@ -203,7 +283,8 @@ defs_std = """
 
 defs_all = [
     defs_pyhelper, defs_serialqueue, defs_std, defs_stepcompress,
-    defs_itersolve, defs_trapq, defs_trdispatch,
+    defs_itersolve, defs_trapq, defs_trdispatch, defs_msgcodec,
+    defs_gcodeparse, defs_gcodearc, defs_sensorparse, defs_bedmesh,
     defs_kin_cartesian, defs_kin_corexy, defs_kin_corexz, defs_kin_delta,
     defs_kin_polar, defs_kin_rotary_delta, defs_kin_winch, defs_kin_extruder,
     defs_kin_shaper,
@@ -0,0 +1,183 @@
+// Bed mesh z lookup and move splitting
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <math.h> // floor
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include "compiler.h" // __visible
+#include "pyhelper.h" // errorf
+
+struct bed_mesh {
+    double x_min, x_dist, y_min, y_dist;
+    double x_offset, y_offset;
+    int x_count, y_count;
+    double *matrix;
+};
+
+// Allocate a lookup grid of x_count by y_count z values
+struct bed_mesh * __visible
+bed_mesh_alloc(int x_count, int y_count)
+{
+    if (x_count < 2 || y_count < 2) {
+        errorf("bed_mesh_alloc invalid size %d,%d", x_count, y_count);
+        return NULL;
+    }
+    struct bed_mesh *bm = malloc(sizeof(*bm));
+    memset(bm, 0, sizeof(*bm));
+    bm->x_count = x_count;
+    bm->y_count = y_count;
+    bm->matrix = malloc(sizeof(bm->matrix[0]) * x_count * y_count);
+    memset(bm->matrix, 0, sizeof(bm->matrix[0]) * x_count * y_count);
+    return bm;
+}
+
+void __visible
+bed_mesh_free(struct bed_mesh *bm)
+{
+    if (!bm)
+        return;
+    free(bm->matrix);
+    free(bm);
+}
+
+// Set the location and spacing of the grid points
+void __visible
+bed_mesh_set_geometry(struct bed_mesh *bm, double x_min, double x_dist
+                      , double y_min, double y_dist)
+{
+    bm->x_min = x_min;
+    bm->x_dist = x_dist;
+    bm->y_min = y_min;
+    bm->y_dist = y_dist;
+}
+
+// Set the z values of one row (constant y) of the grid
+void __visible
+bed_mesh_set_row(struct bed_mesh *bm, int row, const double *z_values)
+{
+    if (row < 0 || row >= bm->y_count)
+        return;
+    memcpy(&bm->matrix[row * bm->x_count], z_values
+           , sizeof(bm->matrix[0]) * bm->x_count);
+}
+
+void __visible
+bed_mesh_set_offsets(struct bed_mesh *bm, double x_offset, double y_offset)
+{
+    bm->x_offset = x_offset;
+    bm->y_offset = y_offset;
+}
+
+static double
+lerp(double t, double v0, double v1)
+{
+    return (1. - t) * v0 + t * v1;
+}
+
+// Find the grid cell containing 'coord' and the position within it
+static int
+linear_index(double coord, double c_min, double c_dist, int count, double *t)
+{
+    int idx = floor((coord - c_min) / c_dist);
+    if (idx > count - 2)
+        idx = count - 2;
+    if (idx < 0)
+        idx = 0;
+    double ct = (coord - (c_min + c_dist * idx)) / c_dist;
+    *t = ct > 1. ? 1. : (ct < 0. ? 0. : ct);
+    return idx;
+}
+
+// Bilinear interpolation of the grid at the given position
+double __visible
+bed_mesh_calc_z(struct bed_mesh *bm, double x, double y)
+{
+    double tx, ty;
+    int xidx = linear_index(x + bm->x_offset, bm->x_min, bm->x_dist
+                            , bm->x_count, &tx);
+    int yidx = linear_index(y + bm->y_offset, bm->y_min, bm->y_dist
+                            , bm->y_count, &ty);
+    double *row0 = &bm->matrix[yidx * bm->x_count + xidx];
+    double *row1 = row0 + bm->x_count;
+    double z0 = lerp(tx, row0[0], row0[1]);
+    double z1 = lerp(tx, row1[0], row1[1]);
+    return lerp(ty, z0, z1);
+}
+
+// Z adjustment at a position after applying the fade factor
+static double
+calc_z_offset(struct bed_mesh *bm, const double *pos, double factor
+              , double fade_offset)
+{
+    double z = bed_mesh_calc_z(bm, pos[0], pos[1]);
+    return factor * (z - fade_offset) + fade_offset;
+}
+
+static int
+is_axis_move(double d)
+{
+    // Matches python's not isclose(d, 0., abs_tol=1e-10)
+    double ad = fabs(d), tol = 1e-09 * ad;
+    return ad > (tol > 1e-10 ? tol : 1e-10);
+}
+
+// Split a move from 'prev' to 'next' (x, y, z, e positions) wherever
+// the z adjustment changes by at least 'split_delta_z', checking every
+// 'move_check_distance' along the move.  The z adjusted end positions
+// of the resulting moves are stored in 'out' (up to 'max_moves').
+// Returns the total number of moves (which may exceed 'max_moves'),
+// or -1 on error.
+int __visible
+bed_mesh_split_move(struct bed_mesh *bm, const double *prev
+                    , const double *next, double factor, double fade_offset
+                    , double split_delta_z, double move_check_distance
+                    , double *out, int max_moves)
+{
+    double axes_d[4], cur[4];
+    int axis_move[4], i, count = 0;
+    for (i = 0; i < 4; i++) {
+        axes_d[i] = next[i] - prev[i];
+        axis_move[i] = is_axis_move(axes_d[i]);
+        cur[i] = prev[i];
+    }
+    double total_move_length = sqrt(axes_d[0]*axes_d[0] + axes_d[1]*axes_d[1]
+                                    + axes_d[2]*axes_d[2]);
+    double z_offset = calc_z_offset(bm, prev, factor, fade_offset);
+    if (axis_move[0] || axis_move[1]) {
+        // X and/or Y axis move, traverse if necessary
+        double distance_checked = 0.;
+        while (distance_checked + move_check_distance < total_move_length) {
+            distance_checked += move_check_distance;
+            double t = distance_checked / total_move_length;
+            if (t > 1. || t < 0.)
+                return -1;
+            for (i = 0; i < 4; i++)
+                if (axis_move[i])
+                    cur[i] = lerp(t, prev[i], next[i]);
+            double next_z = calc_z_offset(bm, cur, factor, fade_offset);
+            if (fabs(next_z - z_offset) < split_delta_z)
+                continue;
+            z_offset = next_z;
+            if (count < max_moves) {
+                double *o = &out[count * 4];
+                o[0] = cur[0];
+                o[1] = cur[1];
+                o[2] = cur[2] + z_offset;
+                o[3] = cur[3];
+            }
+            count++;
+        }
+    }
+    // End of move reached
+    if (count < max_moves) {
+        double *o = &out[count * 4];
+        o[0] = next[0];
+        o[1] = next[1];
+        o[2] = next[2] + calc_z_offset(bm, next, factor, fade_offset);
+        o[3] = next[3];
+    }
+    return count + 1;
+}
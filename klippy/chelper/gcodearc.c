@@ -0,0 +1,90 @@
+// Conversion of G-Code arcs (G2/G3) into linear segments
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <math.h> // atan2
+#include "compiler.h" // __visible
+
+// Determine the length of each segment of an arc with the given
+// radius.  If a chord tolerance is given, use the longest segment
+// that deviates no more than the tolerance from the arc (but not
+// shorter than 'mm_per_segment').
+static double
+calc_segment_length(double radius, double mm_per_segment
+                    , double chord_tolerance)
+{
+    if (chord_tolerance <= 0.)
+        return mm_per_segment;
+    double chord = 2. * radius;
+    if (chord_tolerance < radius)
+        chord = 2. * sqrt(chord_tolerance * (2. * radius - chord_tolerance));
+    return chord > mm_per_segment ? chord : mm_per_segment;
+}
+
+// Plan an arc from 'start' to 'target' (x, y, z coordinates) around
+// the center at 'start' plus (offset_i, offset_j).  The end position
+// of each linear segment is stored in 'out' (up to 'max_segments').
+// Returns the total number of segments (which may exceed
+// 'max_segments').  Derived from Marlin's plan_arc().
+int __visible
+gcode_arc_plan(const double *start, const double *target, double offset_i
+               , double offset_j, int clockwise, double mm_per_segment
+               , double chord_tolerance, double *out, int max_segments)
+{
+    // Radius vector from center to current location
+    double r_p = -offset_i, r_q = -offset_j;
+
+    // Determine angular travel
+    double center_p = start[0] - r_p, center_q = start[1] - r_q;
+    double rt_x = target[0] - center_p, rt_y = target[1] - center_q;
+    double angular_travel = atan2(r_p * rt_y - r_q * rt_x
+                                  , r_p * rt_x + r_q * rt_y);
+    if (angular_travel < 0.)
+        angular_travel += 2. * M_PI;
+    if (clockwise)
+        angular_travel -= 2. * M_PI;
+    if (angular_travel == 0. && start[0] == target[0]
+        && start[1] == target[1])
+        // Make a circle if the angular rotation is 0 and the target
+        // is the current position
+        angular_travel = 2. * M_PI;
+
+    // Determine number of segments
+    double linear_travel = target[2] - start[2];
+    double radius = hypot(r_p, r_q);
+    double flat_mm = radius * angular_travel;
+    double mm_of_travel = (linear_travel ? hypot(flat_mm, linear_travel)
+                           : fabs(flat_mm));
+    double seg_len = calc_segment_length(radius, mm_per_segment
+                                         , chord_tolerance);
+    double segments = floor(mm_of_travel / seg_len);
+    if (!(segments >= 1.))
+        segments = 1.;
+    if (segments > (double)(1 << 30))
+        segments = (double)(1 << 30);
+    int count = segments;
+
+    // Generate coordinates
+    double theta_per_segment = angular_travel / segments;
+    double linear_per_segment = linear_travel / segments;
+    int i;
+    for (i = 1; i < count && i <= max_segments; i++) {
+        double cos_ti = cos(i * theta_per_segment);
+        double sin_ti = sin(i * theta_per_segment);
+        r_p = -offset_i * cos_ti + offset_j * sin_ti;
+        r_q = -offset_i * sin_ti - offset_j * cos_ti;
+        double *o = &out[(i - 1) * 3];
+        o[0] = center_p + r_p;
+        o[1] = center_q + r_q;
+        o[2] = start[2] + i * linear_per_segment;
+    }
+    if (count <= max_segments) {
+        double *o = &out[(count - 1) * 3];
+        o[0] = target[0];
+        o[1] = target[1];
+        o[2] = target[2];
+    }
+    return count;
+}
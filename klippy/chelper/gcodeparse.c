@@ -0,0 +1,145 @@
+// Native parsing of simple G-Code move commands
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <stdint.h> // uint32_t
+#include <stdlib.h> // strtod
+#include <string.h> // memcpy
+#include "compiler.h" // __visible
+
+struct gcode_params {
+    uint32_t mask;
+    double values[26];
+};
+
+static int
+is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int
+is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Check that 's' starts with a plain decimal number (as accepted by
+// both the python float() parser and strtod()) and return its length
+static int
+check_number(const char *s)
+{
+    const char *p = s;
+    if (*p == '+' || *p == '-')
+        p++;
+    int digits = 0;
+    while (is_digit(*p)) {
+        p++;
+        digits++;
+    }
+    if (*p == '.') {
+        p++;
+        while (is_digit(*p)) {
+            p++;
+            digits++;
+        }
+    }
+    if (!digits)
+        return 0;
+    return p - s;
+}
+
+// Parse a "G0", "G1", "G2", or "G3" command line into 'gp'.  Returns
+// the G-Code number on success or -1 if the line is not a simple move
+// command (in which case the caller should use the generic parser).
+int __visible
+gcode_parse_move(struct gcode_params *gp, const char *line)
+{
+    gp->mask = 0;
+    int gnum = -1, first = 1;
+    const char *p = line;
+    for (;;) {
+        while (is_space(*p))
+            p++;
+        char c = *p;
+        if (!c || c == ';')
+            break;
+        if (c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        if (c < 'A' || c > 'Z')
+            return -1;
+        p++;
+        char next = *p;
+        if ((next >= 'A' && next <= 'Z') || (next >= 'a' && next <= 'z')
+            || next == '_')
+            // Multi-character parameter names use the generic parser
+            return -1;
+        while (is_space(*p))
+            p++;
+        int len = check_number(p);
+        if (!len)
+            return -1;
+        const char *numstart = p;
+        p += len;
+        while (is_space(*p))
+            p++;
+        next = *p;
+        if (next && next != ';' && !((next >= 'A' && next <= 'Z')
+                                     || (next >= 'a' && next <= 'z')))
+            return -1;
+        if (gnum < 0) {
+            if (first && c == 'N') {
+                // Skip line number at start of command
+                first = 0;
+                continue;
+            }
+            if (c != 'G' || len != 1 || *numstart < '0' || *numstart > '3')
+                return -1;
+            gnum = *numstart - '0';
+        }
+        first = 0;
+        char buf[32];
+        if (len >= sizeof(buf))
+            return -1;
+        memcpy(buf, numstart, len);
+        buf[len] = '\0';
+        int idx = c - 'A';
+        gp->values[idx] = strtod(buf, NULL);
+        gp->mask |= 1 << idx;
+    }
+    return gnum;
+}
+
+// Binary move records (see klippy/extras/virtual_sdcard.py) start
+// with a tag byte: bit 7 set, the G-Code number in bits 5-6, and a
+// mask of the X, Y, Z, E, F parameters present in bits 0-4.  The tag
+// is followed by a little-endian double for each parameter present.
+static const char binary_params[] = { 'X', 'Y', 'Z', 'E', 'F' };
+
+// Decode a binary move record into 'gp'.  Returns the G-Code number
+// or -1 if the record is not a move record.
+int __visible
+gcode_decode_move(struct gcode_params *gp, const uint8_t *data, int len)
+{
+    gp->mask = 0;
+    if (len < 1 || !(data[0] & 0x80))
+        return -1;
+    uint8_t tag = data[0];
+    const uint8_t *p = &data[1], *end = &data[len];
+    int i;
+    for (i = 0; i < ARRAY_SIZE(binary_params); i++) {
+        if (!(tag & (1 << i)))
+            continue;
+        if (p + sizeof(double) > end) {
+            gp->mask = 0;
+            return -1;
+        }
+        int idx = binary_params[i] - 'A';
+        memcpy(&gp->values[idx], p, sizeof(double));
+        gp->mask |= 1 << idx;
+        p += sizeof(double);
+    }
+    return (tag >> 5) & 0x03;
+}
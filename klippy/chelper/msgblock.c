@@ -7,6 +7,7 @@
 #include <stddef.h> // offsetof
 #include <stdlib.h> // malloc
 #include <string.h> // memset
+#include "compiler.h" // __visible
 #include "msgblock.h" // message_alloc
 #include "pyhelper.h" // errorf
 
@@ -119,6 +120,145 @@ msgblock_decode(uint32_t *data, int data_len, uint8_t *msg, int msg_len)
 }
 
 
+/****************************************************************
+ * Message codec
+ ****************************************************************/
+
+// Parameter type codes (as generated by klippy/msgproto.py)
+enum {
+    MCT_UINT = 'u', MCT_INT = 'i', MCT_STRING = 's', MCT_OTHER = 'o',
+};
+
+struct msgcodec_format {
+    int param_count, int_only;
+    char param_types[MESSAGE_PAYLOAD_MAX];
+};
+
+struct msgcodec {
+    struct msgcodec_format *formats[128];
+};
+
+// Encode a parameter using the same vlq byte sequence as msgproto.py
+static uint8_t *
+encode_param(uint8_t *p, int64_t v)
+{
+    if (v >= 0xc000000 || v < -0x4000000) *p++ = ((v>>28) & 0x7f) | 0x80;
+    if (v >= 0x180000 || v < -0x80000)    *p++ = ((v>>21) & 0x7f) | 0x80;
+    if (v >= 0x3000 || v < -0x1000)       *p++ = ((v>>14) & 0x7f) | 0x80;
+    if (v >= 0x60 || v < -0x20)           *p++ = ((v>>7) & 0x7f) | 0x80;
+    *p++ = v & 0x7f;
+    return p;
+}
+
+// Allocate a 'struct msgcodec' object
+struct msgcodec * __visible
+msgcodec_alloc(void)
+{
+    struct msgcodec *mc = malloc(sizeof(*mc));
+    memset(mc, 0, sizeof(*mc));
+    return mc;
+}
+
+// Free the storage from a previous msgcodec_alloc() call
+void __visible
+msgcodec_free(struct msgcodec *mc)
+{
+    if (!mc)
+        return;
+    int i;
+    for (i=0; i<ARRAY_SIZE(mc->formats); i++)
+        free(mc->formats[i]);
+    free(mc);
+}
+
+// Register the parameter types of a message (one type code per parameter)
+int __visible
+msgcodec_add_format(struct msgcodec *mc, int msgid, const char *param_types)
+{
+    int count = strlen(param_types);
+    if (msgid < 0 || msgid >= ARRAY_SIZE(mc->formats)
+        || count > MESSAGE_PAYLOAD_MAX)
+        return -1;
+    struct msgcodec_format *mf = malloc(sizeof(*mf));
+    memset(mf, 0, sizeof(*mf));
+    mf->param_count = count;
+    mf->int_only = 1;
+    int i;
+    for (i=0; i<count; i++) {
+        char t = param_types[i];
+        if (t != MCT_UINT && t != MCT_INT)
+            mf->int_only = 0;
+        mf->param_types[i] = t;
+    }
+    free(mc->formats[msgid]);
+    mc->formats[msgid] = mf;
+    return 0;
+}
+
+// Encode a message containing only integer parameters.  Returns the
+// encoded length or -1 if the message can not be encoded natively.
+int __visible
+msgcodec_encode(struct msgcodec *mc, int msgid, int64_t *params, int count
+                , uint8_t *out)
+{
+    if (msgid < 0 || msgid >= ARRAY_SIZE(mc->formats))
+        return -1;
+    struct msgcodec_format *mf = mc->formats[msgid];
+    if (!mf || !mf->int_only || count < mf->param_count)
+        return -1;
+    uint8_t *p = out;
+    *p++ = msgid;
+    int i;
+    for (i=0; i<mf->param_count; i++) {
+        p = encode_param(p, params[i]);
+        if (p > &out[MESSAGE_PAYLOAD_MAX])
+            return -1;
+    }
+    return p - out;
+}
+
+// Decode the parameters of a message block containing a single
+// message.  Integer parameters are stored in 'params'; for other
+// types the offset of the parameter in 'msg' is stored instead.
+// Returns the number of parameters or -1 on error.
+int __visible
+msgcodec_decode(struct msgcodec *mc, uint8_t *msg, int msg_len
+                , int64_t *params, int max_params)
+{
+    if (msg_len < MESSAGE_MIN + 1)
+        return -1;
+    uint8_t *p = &msg[MESSAGE_HEADER_SIZE];
+    uint8_t *end = &msg[msg_len - MESSAGE_TRAILER_SIZE];
+    int msgid = *p++;
+    if (msgid >= ARRAY_SIZE(mc->formats))
+        return -1;
+    struct msgcodec_format *mf = mc->formats[msgid];
+    if (!mf || mf->param_count > max_params)
+        return -1;
+    int i;
+    for (i=0; i<mf->param_count; i++) {
+        if (p >= end)
+            return -1;
+        char t = mf->param_types[i];
+        if (t == MCT_STRING) {
+            params[i] = p - msg;
+            p += *p + 1;
+            continue;
+        }
+        if (t == MCT_OTHER)
+            params[i] = p - msg;
+        uint32_t v = parse_int(&p);
+        if (t == MCT_UINT)
+            params[i] = v;
+        else if (t == MCT_INT)
+            params[i] = (int32_t)v;
+    }
+    if (p != end)
+        return -1;
+    return mf->param_count;
+}
+
+
 /****************************************************************
  * Command queues
  ****************************************************************/
@@ -0,0 +1,326 @@
+// Decoding of bulk sensor data messages
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <math.h> // nearbyint
+#include <stdint.h> // uint8_t
+#include "compiler.h" // __visible
+
+struct adxl345_decode {
+    int axes_pos[3];
+    double axes_scale[3];
+    double time_base, chip_base, inv_freq;
+    int64_t last_sequence, last_chip_clock;
+    uint32_t error_count;
+};
+
+#define ADXL345_BYTES_PER_SAMPLE 5
+#define ADXL345_SAMPLES_PER_BLOCK 10
+
+// Round to 6 decimal places (as done by python's round(v, 6))
+static double
+round6(double v)
+{
+    return nearbyint(v * 1000000.) / 1000000.;
+}
+
+// Store a sample as a (time, x, y, z) tuple
+static void
+adxl345_store(struct adxl345_decode *ad, double *o, int32_t *raw, double cdiff)
+{
+    o[0] = round6(ad->time_base + cdiff * ad->inv_freq);
+    o[1] = round6(raw[ad->axes_pos[0]] * ad->axes_scale[0]);
+    o[2] = round6(raw[ad->axes_pos[1]] * ad->axes_scale[1]);
+    o[3] = round6(raw[ad->axes_pos[2]] * ad->axes_scale[2]);
+}
+
+// Extend a 16bit sequence relative to last_sequence
+static int64_t
+extend_sequence(int64_t last_sequence, uint16_t sequence)
+{
+    int32_t seq_diff = (uint16_t)(last_sequence - sequence);
+    seq_diff -= (seq_diff & 0x8000) << 1;
+    return last_sequence - seq_diff;
+}
+
+// Decode a batch of adxl345_data messages.  The message payloads are
+// concatenated in 'data' with their lengths in 'lengths'.  Samples are
+// stored in 'out' as (time, x, y, z) tuples.  Returns the number of
+// samples stored.
+int __visible
+adxl345_decode_samples(struct adxl345_decode *ad, const uint8_t *data
+                       , const uint16_t *sequences, const int *lengths
+                       , int msg_count, double *out, int max_samples)
+{
+    int64_t last_sequence = ad->last_sequence, seq = 0;
+    int count = 0, last_i = 0, m;
+    for (m = 0; m < msg_count; m++) {
+        seq = extend_sequence(last_sequence, sequences[m]);
+        double msg_cdiff = seq * ADXL345_SAMPLES_PER_BLOCK - ad->chip_base;
+        int num = lengths[m] / ADXL345_BYTES_PER_SAMPLE, i;
+        for (i = 0; i < num; i++) {
+            const uint8_t *d = &data[i * ADXL345_BYTES_PER_SAMPLE];
+            uint8_t xlow = d[0], ylow = d[1], zlow = d[2];
+            uint8_t xzhigh = d[3], yzhigh = d[4];
+            if (yzhigh & 0x80) {
+                ad->error_count++;
+                continue;
+            }
+            if (count >= max_samples)
+                continue;
+            int32_t raw[3];
+            raw[0] = (xlow | ((xzhigh & 0x1f) << 8)) - ((xzhigh & 0x10) << 9);
+            raw[1] = (ylow | ((yzhigh & 0x1f) << 8)) - ((yzhigh & 0x10) << 9);
+            raw[2] = ((zlow | ((xzhigh & 0xe0) << 3) | ((yzhigh & 0xe0) << 6))
+                      - ((yzhigh & 0x40) << 7));
+            adxl345_store(ad, &out[count * 4], raw, msg_cdiff + i);
+            count++;
+        }
+        if (num)
+            last_i = num - 1;
+        data += lengths[m];
+    }
+    ad->last_chip_clock = seq * ADXL345_SAMPLES_PER_BLOCK + last_i;
+    return count;
+}
+
+// Zigzag code sent in place of a delta encoded sample on a data error
+#define ADXL345_DELTA_ERROR 0xffff
+
+// Read a varint from 'data'.  Returns -1 if the data is truncated.
+static int32_t
+read_varint(const uint8_t **pdata, const uint8_t *end)
+{
+    const uint8_t *d = *pdata;
+    uint32_t v = 0;
+    int shift;
+    for (shift = 0; shift < 21; shift += 7) {
+        if (d >= end)
+            return -1;
+        uint8_t b = *d++;
+        v |= (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *pdata = d;
+            return v;
+        }
+    }
+    return -1;
+}
+
+// Decode a batch of delta encoded adxl345_data messages (the sequence
+// of each message is the index of its first sample).  Each sample
+// axis is a zigzag varint holding the difference from a linear
+// prediction based on the previous two samples in the message.
+int __visible
+adxl345_decode_delta_samples(struct adxl345_decode *ad, const uint8_t *data
+                             , const uint16_t *sequences, const int *lengths
+                             , int msg_count, double *out, int max_samples)
+{
+    int64_t last_sequence = ad->last_sequence, seq = 0;
+    int count = 0, last_i = 0, m;
+    for (m = 0; m < msg_count; m++) {
+        seq = extend_sequence(last_sequence, sequences[m]);
+        double msg_cdiff = seq - ad->chip_base;
+        const uint8_t *d = data, *end = &data[lengths[m]];
+        int32_t last[3] = {0, 0, 0}, last2[3] = {0, 0, 0};
+        int pred_count = 0, i = 0;
+        for (; d < end; i++) {
+            int32_t raw[3];
+            int j;
+            for (j = 0; j < 3; j++) {
+                int32_t z = read_varint(&d, end);
+                if (z < 0) {
+                    // Truncated message
+                    d = end;
+                    break;
+                }
+                if (!j && z == ADXL345_DELTA_ERROR)
+                    break;
+                int32_t pred = 0;
+                if (pred_count == 1)
+                    pred = last[j];
+                else if (pred_count >= 2)
+                    pred = 2 * last[j] - last2[j];
+                raw[j] = (int16_t)(pred + ((z >> 1) ^ -(z & 1)));
+                last2[j] = last[j];
+                last[j] = raw[j];
+            }
+            if (j < 3) {
+                ad->error_count++;
+                continue;
+            }
+            if (pred_count < 2)
+                pred_count++;
+            if (count >= max_samples)
+                continue;
+            adxl345_store(ad, &out[count * 4], raw, msg_cdiff + i);
+            count++;
+        }
+        if (i)
+            last_i = i - 1;
+        data += lengths[m];
+    }
+    ad->last_chip_clock = seq + last_i;
+    return count;
+}
+
+
+/****************************************************************
+ * Angle sensor decoding
+ ****************************************************************/
+
+#define ANGLE_TCODE_ERROR 0xff
+
+// Decode the (tcode, angle) entries of a delta encoded spi_angle_data
+// message.  Each angle is a zigzag varint holding the difference from
+// a linear prediction based on the previous two angles in the
+// message.  Returns the number of entries.
+int __visible
+angle_decode_delta(const uint8_t *data, int len, uint8_t *tcodes
+                   , uint16_t *raw_angles)
+{
+    int pos = 0, count = 0, pred_count = 0;
+    uint16_t last_angle = 0, last2_angle = 0;
+    while (pos + 1 < len) {
+        uint8_t tcode = data[pos];
+        if (tcode == ANGLE_TCODE_ERROR) {
+            tcodes[count] = tcode;
+            raw_angles[count++] = data[pos + 1];
+            pos += 2;
+            continue;
+        }
+        pos++;
+        uint32_t zz = 0;
+        int shift = 0;
+        while (pos < len) {
+            uint8_t b = data[pos++];
+            zz |= (uint32_t)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80) || shift >= 21)
+                break;
+        }
+        uint16_t pred = 0;
+        if (pred_count == 1)
+            pred = last_angle;
+        else if (pred_count >= 2)
+            pred = 2 * last_angle - last2_angle;
+        pred_count++;
+        uint16_t angle = pred + ((zz >> 1) ^ -(zz & 1));
+        tcodes[count] = tcode;
+        raw_angles[count++] = angle;
+        last2_angle = last_angle;
+        last_angle = angle;
+    }
+    return count;
+}
+
+struct angle_decode {
+    int64_t start_clock, sample_ticks, last_sequence, last_angle;
+    int64_t last_chip_mcu_clock, last_chip_clock;
+    double chip_freq, clock_offset, clock_freq, static_delay;
+    int time_shift, is_tcode_absolute, is_delta_encoded;
+    int has_calibration, calibration_reversed;
+    int32_t calibration[65];
+    uint32_t error_count;
+};
+
+#define ANGLE_RAW_MSG_SAMPLES 16
+#define ANGLE_BITS 16
+#define ANGLE_CALIBRATION_BITS 6
+
+// Adjust an angle using the linear interpolation calibration table
+static int64_t
+angle_calibrate(struct angle_decode *ad, int64_t angle)
+{
+    int interp_bits = ANGLE_BITS - ANGLE_CALIBRATION_BITS;
+    int64_t interp_mask = (1 << interp_bits) - 1;
+    int64_t interp_round = 1 << (interp_bits - 1);
+    int bucket = (angle & 0xffff) >> interp_bits;
+    int64_t cal1 = ad->calibration[bucket], cal2 = ad->calibration[bucket+1];
+    int64_t adj = (angle & interp_mask) * (cal2 - cal1);
+    adj = cal1 + ((adj + interp_round) >> interp_bits);
+    int64_t angle_diff = (angle - adj) & 0xffff;
+    angle_diff -= (angle_diff & 0x8000) << 1;
+    int64_t new_angle = angle - angle_diff;
+    return ad->calibration_reversed ? -new_angle : new_angle;
+}
+
+// Process a single spi_angle_data entry.  Returns 1 if a sample was
+// stored in 'times' and 'angles'.
+static int
+angle_process_entry(struct angle_decode *ad, int64_t mclock, uint8_t tcode
+                    , uint16_t raw_angle, double *time, int64_t *angle)
+{
+    if (tcode == ANGLE_TCODE_ERROR) {
+        ad->error_count++;
+        return 0;
+    }
+    // Unwrap the 16bit angle
+    int64_t angle_diff = (ad->last_angle - raw_angle) & 0xffff;
+    angle_diff -= (angle_diff & 0x8000) << 1;
+    ad->last_angle -= angle_diff;
+    double sclock;
+    if (ad->is_tcode_absolute) {
+        // tcode is tle5012b frame counter
+        int64_t mdiff = mclock - ad->last_chip_mcu_clock;
+        int64_t chip_mclock = (ad->last_chip_clock
+                               + (int64_t)(mdiff * ad->chip_freq + .5));
+        int32_t cdiff = (uint16_t)(((int64_t)tcode << 10) - chip_mclock);
+        cdiff -= (cdiff & 0x8000) << 1;
+        sclock = mclock + (cdiff - 0x800) * (1. / ad->chip_freq);
+    } else {
+        // tcode is mcu clock offset shifted by time_shift
+        sclock = mclock + ((int64_t)tcode << ad->time_shift);
+    }
+    double ptime = sclock / ad->clock_freq + ad->clock_offset;
+    *time = round6(ptime - ad->static_delay);
+    *angle = (ad->has_calibration ? angle_calibrate(ad, ad->last_angle)
+              : ad->last_angle);
+    return 1;
+}
+
+// Decode a batch of spi_angle_data messages.  Sample times and
+// angles are stored in 'times' and 'angles'.  Returns the number of
+// samples stored.
+int __visible
+angle_decode_samples(struct angle_decode *ad, const uint8_t *data
+                     , const uint16_t *sequences, const int *lengths
+                     , int msg_count, double *times, int64_t *angles
+                     , int max_samples)
+{
+    int count = 0, m;
+    for (m = 0; m < msg_count; m++) {
+        int64_t seq = (ad->last_sequence & ~0xffffLL) | sequences[m];
+        if (seq < ad->last_sequence)
+            seq += 0x10000;
+        ad->last_sequence = seq;
+        int len = lengths[m], num, i;
+        uint8_t tcodes[256];
+        uint16_t raw_angles[256];
+        int64_t msg_mclock;
+        if (ad->is_delta_encoded) {
+            // Sequence is the index of the first sample in the message
+            num = angle_decode_delta(data, len, tcodes, raw_angles);
+            msg_mclock = ad->start_clock + seq * ad->sample_ticks;
+        } else {
+            num = len / 3;
+            for (i = 0; i < num; i++) {
+                tcodes[i] = data[i*3];
+                raw_angles[i] = data[i*3 + 1] | (data[i*3 + 2] << 8);
+            }
+            msg_mclock = (ad->start_clock
+                          + seq * ANGLE_RAW_MSG_SAMPLES * ad->sample_ticks);
+        }
+        for (i = 0; i < num; i++) {
+            if (count >= max_samples)
+                break;
+            int64_t mclock = msg_mclock + i * ad->sample_ticks;
+            count += angle_process_entry(ad, mclock, tcodes[i], raw_angles[i]
+                                         , &times[count], &angles[count]);
+        }
+        data += len;
+    }
+    return count;
+}
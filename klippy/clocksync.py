@@ -22,6 +22,7 @@ class ClockSync:
         # Minimum round-trip-time tracking
         self.min_half_rtt = 999999999.9
         self.min_rtt_time = 0.
+        self.last_rtt = 0.
         # Linear regression of mcu clock and system sent_time
         self.time_avg = self.time_variance = 0.
         self.clock_avg = self.clock_covariance = 0.
@@ -76,6 +77,7 @@ class ClockSync:
             return
         receive_time = params['#receive_time']
         half_rtt = .5 * (receive_time - sent_time)
+        self.last_rtt = receive_time - sent_time
         aged_rtt = (sent_time - self.min_rtt_time) * RTT_AGE
         if half_rtt < self.min_half_rtt + aged_rtt:
             self.min_half_rtt = half_rtt
@@ -126,6 +128,9 @@ class ClockSync:
         return int(print_time * self.mcu_freq)
     def clock_to_print_time(self, clock):
         return clock / self.mcu_freq
+    def get_print_time_translation(self):
+        # print_time == clock / freq + offset
+        return (0., self.mcu_freq)
     # system time conversions
     def get_clock(self, eventtime):
         sample_time, clock, freq = self.clock_est
@@ -135,6 +140,8 @@ class ClockSync:
         return float(reqclock - clock)/freq + sample_time
     def estimated_print_time(self, eventtime):
         return self.clock_to_print_time(self.get_clock(eventtime))
+    def get_last_rtt(self):
+        return self.last_rtt
     # misc commands
     def clock32_to_clock64(self, clock32):
         last_clock = self.last_clock
@@ -187,6 +194,8 @@ class SecondarySync(ClockSync):
     def clock_to_print_time(self, clock):
         adjusted_offset, adjusted_freq = self.clock_adj
         return clock / adjusted_freq + adjusted_offset
+    def get_print_time_translation(self):
+        return self.clock_adj
     # misc commands
     def dump_debug(self):
         adjusted_offset, adjusted_freq = self.clock_adj
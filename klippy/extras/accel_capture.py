@@ -0,0 +1,83 @@
+# Binary storage format for raw accelerometer captures
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import array, gzip, json, struct, sys
+
+# A capture file starts with a fixed header (magic, version, length of
+# the json metadata), followed by the json metadata (padded to an
+# eight byte boundary).  The samples follow in columns: all sample
+# times as little-endian doubles and then the x, y, and z
+# accelerations as little-endian floats.  Files ending in ".gz" are
+# gzip compressed.
+CAPTURE_MAGIC = b"KACC"
+CAPTURE_VERSION = 1
+HEADER_FORMAT = "<4sII"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+GZIP_MAGIC = b"\x1f\x8b"
+
+FORMAT_EXTENSIONS = {'binary': '.kac', 'compressed': '.kac.gz'}
+
+def get_capture_filename(filename, capture_format):
+    ext = FORMAT_EXTENSIONS.get(capture_format)
+    if ext is None:
+        return filename
+    if filename.endswith('.csv'):
+        filename = filename[:-4]
+    return filename + ext
+
+def _get_le_bytes(arr):
+    if sys.byteorder != 'little':
+        arr.byteswap()
+    if sys.version_info[0] < 3:
+        return arr.tostring()
+    return arr.tobytes()
+
+def write_capture(filename, samples, metadata):
+    metadata = dict(metadata)
+    metadata['count'] = len(samples)
+    mdata = json.dumps(metadata, sort_keys=True).encode()
+    mdata += b" " * (-(HEADER_SIZE + len(mdata)) % 8)
+    open_func = gzip.open if filename.endswith('.gz') else open
+    with open_func(filename, "wb") as f:
+        f.write(struct.pack(HEADER_FORMAT, CAPTURE_MAGIC, CAPTURE_VERSION,
+                            len(mdata)))
+        f.write(mdata)
+        f.write(_get_le_bytes(array.array('d', [s[0] for s in samples])))
+        for axis in range(1, 4):
+            accels = array.array('f', [s[axis] for s in samples])
+            f.write(_get_le_bytes(accels))
+
+def is_capture_file(filename):
+    with open(filename, "rb") as f:
+        magic = f.read(len(CAPTURE_MAGIC))
+    if magic.startswith(GZIP_MAGIC):
+        with gzip.open(filename, "rb") as f:
+            magic = f.read(len(CAPTURE_MAGIC))
+    return magic == CAPTURE_MAGIC
+
+# Load a capture as a tuple of (time, accel_x, accel_y, accel_z) column
+# arrays.  The columns are views into the file data (memory-mapped
+# for uncompressed files); the accelerations are float32.
+def read_capture(filename, np):
+    with open(filename, "rb") as f:
+        is_compressed = f.read(len(GZIP_MAGIC)) == GZIP_MAGIC
+    if is_compressed:
+        with gzip.open(filename, "rb") as f:
+            buf = f.read()
+    else:
+        buf = np.memmap(filename, dtype=np.uint8, mode='r')
+    magic, version, mdata_len = struct.unpack_from(HEADER_FORMAT,
+                                                   bytes(buf[:HEADER_SIZE]))
+    if magic != CAPTURE_MAGIC or version != CAPTURE_VERSION:
+        raise ValueError("File %s is not a supported accelerometer capture"
+                         % (filename,))
+    offset = HEADER_SIZE + mdata_len
+    metadata = json.loads(bytes(buf[HEADER_SIZE:offset]).decode())
+    count = metadata['count']
+    times = np.frombuffer(buf, dtype='<f8', count=count, offset=offset)
+    offset += 8 * count
+    accels = np.frombuffer(buf, dtype='<f4', count=3*count, offset=offset)
+    columns = (times,) + tuple(accels.reshape(3, count))
+    return columns, metadata
@@ -4,7 +4,8 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, time, collections, threading, multiprocessing, os
-from . import bus, motion_report
+import chelper
+from . import accel_capture, bus, motion_report
 
 # ADXL345 registers
 REG_DEVID = 0x00
@@ -31,15 +32,36 @@ Accel_Measurement = collections.namedtuple(
 
 # Helper class to obtain measurements
 class ADXL345QueryHelper:
-    def __init__(self, printer, cconn):
+    def __init__(self, printer, cconn, capture_format='csv', metadata=None):
         self.printer = printer
         self.cconn = cconn
+        self.capture_format = capture_format
+        self.metadata = dict(metadata or {})
         print_time = printer.lookup_object('toolhead').get_last_move_time()
         self.request_start_time = self.request_end_time = print_time
         self.samples = self.raw_samples = []
+        self.stream_cb = None
+        self.stream_count = 0
+        self.is_finishing = False
+    def stream_samples(self, stream_cb):
+        # Pass samples to stream_cb as they arrive instead of storing them
+        self.stream_cb = stream_cb
+        self.cconn.set_message_callback(self._handle_stream_msg)
+    def _handle_stream_msg(self, msg):
+        samples = []
+        for samp in msg['params']['data']:
+            samp_time = samp[0]
+            if samp_time < self.request_start_time:
+                continue
+            if self.is_finishing and samp_time > self.request_end_time:
+                break
+            samples.append(samp)
+        self.stream_count += len(samples)
+        self.stream_cb(samples)
     def finish_measurements(self):
         toolhead = self.printer.lookup_object('toolhead')
         self.request_end_time = toolhead.get_last_move_time()
+        self.is_finishing = True
         toolhead.wait_moves()
         self.cconn.finalize()
     def _get_raw_samples(self):
@@ -48,6 +70,8 @@ class ADXL345QueryHelper:
             self.raw_samples = raw_samples
         return self.raw_samples
     def has_valid_samples(self):
+        if self.stream_cb is not None:
+            return self.stream_count > 0
         raw_samples = self._get_raw_samples()
         for msg in raw_samples:
             data = msg['params']['data']
@@ -83,15 +107,22 @@ class ADXL345QueryHelper:
         del samples[count:]
         return self.samples
     def write_to_file(self, filename):
+        # Returns the name of the file written (which depends on the
+        # capture format)
+        filename = accel_capture.get_capture_filename(filename,
+                                                      self.capture_format)
         def write_impl():
             try:
                 # Try to re-nice writing process
                 os.nice(20)
             except:
                 pass
+            samples = self.samples or self.get_samples()
+            if self.capture_format != 'csv':
+                accel_capture.write_capture(filename, samples, self.metadata)
+                return
             f = open(filename, "w")
             f.write("#time,accel_x,accel_y,accel_z\n")
-            samples = self.samples or self.get_samples()
             for t, accel_x, accel_y, accel_z in samples:
                 f.write("%.6f,%.6f,%.6f,%.6f\n" % (
                     t, accel_x, accel_y, accel_z))
@@ -99,6 +130,7 @@ class ADXL345QueryHelper:
         write_proc = multiprocessing.Process(target=write_impl)
         write_proc.daemon = True
         write_proc.start()
+        return filename
 
 # Helper class for G-Code commands
 class ADXLCommandHelper:
@@ -144,7 +176,7 @@ class ADXLCommandHelper:
             filename = "/tmp/adxl345-%s.csv" % (name,)
         else:
             filename = "/tmp/adxl345-%s-%s.csv" % (self.name, name,)
-        bg_client.write_to_file(filename)
+        filename = bg_client.write_to_file(filename)
         gcmd.respond_info("Writing raw accelerometer data to %s file"
                           % (filename,))
     cmd_ACCELEROMETER_QUERY_help = "Query accelerometer for the current values"
@@ -221,6 +253,9 @@ MIN_MSG_TIME = 0.100
 
 BYTES_PER_SAMPLE = 5
 SAMPLES_PER_BLOCK = 10
+MIN_DELTA_BYTES_PER_SAMPLE = 3
+
+ENCODING_RAW, ENCODING_DELTA = 0, 1
 
 # Printer class that controls ADXL345 chip
 class ADXL345:
@@ -237,6 +272,12 @@ class ADXL345:
         self.data_rate = config.getint('rate', 3200)
         if self.data_rate not in QUERY_RATES:
             raise config.error("Invalid rate parameter: %d" % (self.data_rate,))
+        capture_formats = ['csv'] + list(accel_capture.FORMAT_EXTENSIONS)
+        self.capture_format = config.getchoice(
+            'capture_format', {f: f for f in capture_formats}, 'csv')
+        self.capture_metadata = {
+            'chip': config.get_name(), 'rate': self.data_rate,
+            'axes_map': [a.strip() for a in axes_map]}
         # Measurement storage (accessed from background thread)
         self.lock = threading.Lock()
         self.raw_samples = []
@@ -246,6 +287,7 @@ class ADXL345:
         self.oid = oid = mcu.create_oid()
         self.query_adxl345_cmd = self.query_adxl345_end_cmd = None
         self.query_adxl345_status_cmd = None
+        self.is_delta_encoded = False
         mcu.add_config_cmd("config_adxl345 oid=%d spi_oid=%d"
                            % (oid, self.spi.get_oid()))
         mcu.add_config_cmd("query_adxl345 oid=%d clock=0 rest_ticks=0"
@@ -256,6 +298,11 @@ class ADXL345:
         self.last_sequence = self.max_query_duration = 0
         self.last_limit_count = self.last_error_count = 0
         self.clock_sync = ClockSyncRegression(self.mcu, 640)
+        # Native sample decoding
+        self.ffi_main, self.ffi_lib = chelper.get_ffi()
+        self.decode_state = self.ffi_main.new('struct adxl345_decode *')
+        self.decode_state.axes_pos = [pos for pos, scale in self.axes_map]
+        self.decode_state.axes_scale = [scale for pos, scale in self.axes_map]
         # API server endpoints
         self.api_dump = motion_report.APIDumpHelper(
             self.printer, self._api_update, self._api_startstop, 0.100)
@@ -264,6 +311,12 @@ class ADXL345:
         wh.register_mux_endpoint("adxl345/dump_adxl345", "sensor", self.name,
                                  self._handle_dump_adxl345)
     def _build_config(self):
+        # Use delta encoded samples if the mcu supports them
+        if self.mcu.try_lookup_command(
+                "set_adxl345_encoding oid=%c encoding=%c") is not None:
+            self.mcu.add_config_cmd("set_adxl345_encoding oid=%d encoding=%d"
+                                    % (self.oid, ENCODING_DELTA))
+            self.is_delta_encoded = True
         cmdqueue = self.spi.get_command_queue()
         self.query_adxl345_cmd = self.mcu.lookup_command(
             "query_adxl345 oid=%c clock=%u rest_ticks=%u", cq=cmdqueue)
@@ -295,39 +348,28 @@ class ADXL345:
         with self.lock:
             self.raw_samples.append(params)
     def _extract_samples(self, raw_samples):
-        # Load variables to optimize inner loop below
-        (x_pos, x_scale), (y_pos, y_scale), (z_pos, z_scale) = self.axes_map
-        last_sequence = self.last_sequence
+        ad = self.decode_state
+        ad.last_sequence = self.last_sequence
+        ad.error_count = self.last_error_count
         time_base, chip_base, inv_freq = self.clock_sync.get_time_translation()
-        # Process every message in raw_samples
-        count = seq = 0
-        samples = [None] * (len(raw_samples) * SAMPLES_PER_BLOCK)
-        for params in raw_samples:
-            seq_diff = (last_sequence - params['sequence']) & 0xffff
-            seq_diff -= (seq_diff & 0x8000) << 1
-            seq = last_sequence - seq_diff
-            d = bytearray(params['data'])
-            msg_cdiff = seq * SAMPLES_PER_BLOCK - chip_base
-            for i in range(len(d) // BYTES_PER_SAMPLE):
-                d_xyz = d[i*BYTES_PER_SAMPLE:(i+1)*BYTES_PER_SAMPLE]
-                xlow, ylow, zlow, xzhigh, yzhigh = d_xyz
-                if yzhigh & 0x80:
-                    self.last_error_count += 1
-                    continue
-                rx = (xlow | ((xzhigh & 0x1f) << 8)) - ((xzhigh & 0x10) << 9)
-                ry = (ylow | ((yzhigh & 0x1f) << 8)) - ((yzhigh & 0x10) << 9)
-                rz = ((zlow | ((xzhigh & 0xe0) << 3) | ((yzhigh & 0xe0) << 6))
-                      - ((yzhigh & 0x40) << 7))
-                raw_xyz = (rx, ry, rz)
-                x = round(raw_xyz[x_pos] * x_scale, 6)
-                y = round(raw_xyz[y_pos] * y_scale, 6)
-                z = round(raw_xyz[z_pos] * z_scale, 6)
-                ptime = round(time_base + (msg_cdiff + i) * inv_freq, 6)
-                samples[count] = (ptime, x, y, z)
-                count += 1
-        self.clock_sync.set_last_chip_clock(seq * SAMPLES_PER_BLOCK + i)
-        del samples[count:]
-        return samples
+        ad.time_base, ad.chip_base, ad.inv_freq = time_base, chip_base, inv_freq
+        # Decode all messages in raw_samples in a single call
+        datas = [params['data'] for params in raw_samples]
+        sequences = [params['sequence'] for params in raw_samples]
+        lengths = [len(d) for d in datas]
+        if self.is_delta_encoded:
+            max_samples = sum(lengths) // MIN_DELTA_BYTES_PER_SAMPLE
+            decode = self.ffi_lib.adxl345_decode_delta_samples
+        else:
+            max_samples = sum(lengths) // BYTES_PER_SAMPLE
+            decode = self.ffi_lib.adxl345_decode_samples
+        out = self.ffi_main.new('double[]', max_samples * 4)
+        count = decode(ad, self.ffi_main.from_buffer(b"".join(datas)),
+                       sequences, lengths, len(raw_samples), out, max_samples)
+        self.last_error_count = ad.error_count
+        self.clock_sync.set_last_chip_clock(ad.last_chip_clock)
+        v = self.ffi_main.unpack(out, count * 4)
+        return list(zip(v[0::4], v[1::4], v[2::4], v[3::4]))
     def _update_clock(self, minclock=0):
         # Query current state
         for retry in range(5):
@@ -355,8 +397,12 @@ class ADXL345:
                                           self.mcu.seconds_to_clock(.000005))
             return
         self.max_query_duration = 2 * duration
-        msg_count = (sequence * SAMPLES_PER_BLOCK
-                     + buffered // BYTES_PER_SAMPLE + fifo)
+        if self.is_delta_encoded:
+            # Sequence and buffered are reported as sample counts
+            msg_count = sequence + buffered + fifo
+        else:
+            msg_count = (sequence * SAMPLES_PER_BLOCK
+                         + buffered // BYTES_PER_SAMPLE + fifo)
         # The "chip clock" is the message counter plus .5 for average
         # inaccuracy of query responses and plus .5 for assumed offset
         # of adxl345 hw processing time.
@@ -432,7 +478,8 @@ class ADXL345:
         web_request.send({'header': hdr})
     def start_internal_client(self):
         cconn = self.api_dump.add_internal_client()
-        return ADXL345QueryHelper(self.printer, cconn)
+        return ADXL345QueryHelper(self.printer, cconn, self.capture_format,
+                                  self.capture_metadata)
 
 def load_config(config):
     return ADXL345(config)
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, math, threading
+import chelper
 from . import bus, motion_report
 
 MIN_MSG_TIME = 0.100
@@ -19,6 +20,8 @@ class AngleCalibration:
         self.printer = config.get_printer()
         self.name = config.get_name()
         self.stepper_name = config.get('stepper', None)
+        self.calibration_reversed = False
+        self.calibration = []
         if self.stepper_name is None:
             # No calibration
             return
@@ -32,8 +35,6 @@ class AngleCalibration:
         # Current calibration data
         self.mcu_pos_offset = None
         self.angle_phase_offset = 0.
-        self.calibration_reversed = False
-        self.calibration = []
         cal = config.get('calibrate', None)
         if cal is not None:
             data = [d.strip() for d in cal.split(',')]
@@ -70,26 +71,10 @@ class AngleCalibration:
             phase_diff -= phases
         # Store final offset
         self.mcu_pos_offset = mcu_pos - (angle_mpos - phase_diff)
-    def apply_calibration(self, samples):
-        calibration = self.calibration
-        if not calibration:
+    def get_position_offset(self, samples):
+        # The calibration table is applied to samples during decoding
+        if not self.calibration:
             return None
-        calibration_reversed = self.calibration_reversed
-        interp_bits = ANGLE_BITS - CALIBRATION_BITS
-        interp_mask = (1 << interp_bits) - 1
-        interp_round = 1 << (interp_bits - 1)
-        for i, (samp_time, angle) in enumerate(samples):
-            bucket = (angle & 0xffff) >> interp_bits
-            cal1 = calibration[bucket]
-            cal2 = calibration[bucket + 1]
-            adj = (angle & interp_mask) * (cal2 - cal1)
-            adj = cal1 + ((adj + interp_round) >> interp_bits)
-            angle_diff = (angle - adj) & 0xffff
-            angle_diff -= (angle_diff & 0x8000) << 1
-            new_angle = angle - angle_diff
-            if calibration_reversed:
-                new_angle = -new_angle
-            samples[i] = (samp_time, new_angle)
         if self.mcu_pos_offset is None:
             self.calc_mcu_pos_offset(samples[0])
             if self.mcu_pos_offset is None:
@@ -407,6 +392,8 @@ class HelperTLE5012B:
 
 SAMPLE_PERIOD = 0.000400
 
+ENCODING_RAW, ENCODING_DELTA = 0, 1
+
 class Angle:
     def __init__(self, config):
         self.printer = config.get_printer()
@@ -415,7 +402,8 @@ class Angle:
         self.calibration = AngleCalibration(config)
         # Measurement conversion
         self.start_clock = self.time_shift = self.sample_ticks = 0
-        self.last_sequence = self.last_angle = 0
+        self.ffi_main, self.ffi_lib = chelper.get_ffi()
+        self.decode_state = self.ffi_main.new('struct angle_decode *')
         # Measurement storage (accessed from background thread)
         self.lock = threading.Lock()
         self.raw_samples = []
@@ -431,6 +419,7 @@ class Angle:
         self.sensor_helper = sensor_class(config, self.spi, oid)
         # Setup mcu sensor_spi_angle bulk query code
         self.query_spi_angle_cmd = self.query_spi_angle_end_cmd = None
+        self.is_delta_encoded = False
         mcu.add_config_cmd(
             "config_spi_angle oid=%d spi_oid=%d spi_angle_type=%s"
             % (oid, self.spi.get_oid(), sensor_type))
@@ -451,6 +440,13 @@ class Angle:
         freq = self.mcu.seconds_to_clock(1.)
         while float(TCODE_ERROR << self.time_shift) / freq < 0.002:
             self.time_shift += 1
+        # Use delta encoded samples if the mcu supports them
+        if self.mcu.try_lookup_command(
+                "set_spi_angle_encoding oid=%c encoding=%c") is not None:
+            self.mcu.add_config_cmd("set_spi_angle_encoding oid=%d encoding=%d"
+                                    % (self.oid, ENCODING_DELTA))
+            self.is_delta_encoded = True
+        self.decode_state.is_delta_encoded = self.is_delta_encoded
         cmdqueue = self.spi.get_command_queue()
         self.query_spi_angle_cmd = self.mcu.lookup_command(
             "query_spi_angle oid=%c clock=%u rest_ticks=%u time_shift=%c",
@@ -467,60 +463,39 @@ class Angle:
         with self.lock:
             self.raw_samples.append(params)
     def _extract_samples(self, raw_samples):
-        # Load variables to optimize inner loop below
-        sample_ticks = self.sample_ticks
-        start_clock = self.start_clock
-        clock_to_print_time = self.mcu.clock_to_print_time
-        last_sequence = self.last_sequence
-        last_angle = self.last_angle
-        time_shift = 0
-        static_delay = 0.
-        last_chip_mcu_clock = last_chip_clock = chip_freq = inv_chip_freq = 0.
-        is_tcode_absolute = self.sensor_helper.is_tcode_absolute
-        if is_tcode_absolute:
+        ad = self.decode_state
+        ad.error_count = 0
+        ad.is_tcode_absolute = self.sensor_helper.is_tcode_absolute
+        if ad.is_tcode_absolute:
             tparams = self.sensor_helper.get_tcode_params()
             last_chip_mcu_clock, last_chip_clock, chip_freq = tparams
-            inv_chip_freq = 1. / chip_freq
+            ad.last_chip_mcu_clock = last_chip_mcu_clock
+            ad.last_chip_clock = last_chip_clock
+            ad.chip_freq = chip_freq
+            ad.time_shift = 0
+            ad.static_delay = 0.
         else:
-            time_shift = self.time_shift
-            static_delay = self.sensor_helper.get_static_delay()
-        # Process every message in raw_samples
-        count = error_count = 0
-        samples = [None] * (len(raw_samples) * 16)
-        for params in raw_samples:
-            seq = (last_sequence & ~0xffff) | params['sequence']
-            if seq < last_sequence:
-                seq += 0x10000
-            last_sequence = seq
-            d = bytearray(params['data'])
-            msg_mclock = start_clock + seq*16*sample_ticks
-            for i in range(len(d) // 3):
-                tcode = d[i*3]
-                if tcode == TCODE_ERROR:
-                    error_count += 1
-                    continue
-                raw_angle = d[i*3 + 1] | (d[i*3 + 2] << 8)
-                angle_diff = (last_angle - raw_angle) & 0xffff
-                angle_diff -= (angle_diff & 0x8000) << 1
-                last_angle -= angle_diff
-                mclock = msg_mclock + i*sample_ticks
-                if is_tcode_absolute:
-                    # tcode is tle5012b frame counter
-                    mdiff = mclock - last_chip_mcu_clock
-                    chip_mclock = last_chip_clock + int(mdiff * chip_freq + .5)
-                    cdiff = ((tcode << 10) - chip_mclock) & 0xffff
-                    cdiff -= (cdiff & 0x8000) << 1
-                    sclock = mclock + (cdiff - 0x800) * inv_chip_freq
-                else:
-                    # tcode is mcu clock offset shifted by time_shift
-                    sclock = mclock + (tcode<<time_shift)
-                ptime = round(clock_to_print_time(sclock) - static_delay, 6)
-                samples[count] = (ptime, last_angle)
-                count += 1
-        self.last_sequence = last_sequence
-        self.last_angle = last_angle
-        del samples[count:]
-        return samples, error_count
+            ad.time_shift = self.time_shift
+            ad.static_delay = self.sensor_helper.get_static_delay()
+        ad.clock_offset, ad.clock_freq = self.mcu.get_print_time_translation()
+        calibration = self.calibration.calibration
+        ad.has_calibration = len(calibration) > 0
+        if calibration:
+            ad.calibration = calibration
+            ad.calibration_reversed = self.calibration.calibration_reversed
+        # Decode all messages in raw_samples in a single call
+        datas = [params['data'] for params in raw_samples]
+        sequences = [params['sequence'] for params in raw_samples]
+        lengths = [len(d) for d in datas]
+        max_samples = sum(lengths) // 2
+        times = self.ffi_main.new('double[]', max_samples)
+        angles = self.ffi_main.new('int64_t[]', max_samples)
+        count = self.ffi_lib.angle_decode_samples(
+            ad, self.ffi_main.from_buffer(b"".join(datas)), sequences,
+            lengths, len(raw_samples), times, angles, max_samples)
+        samples = list(zip(self.ffi_main.unpack(times, count),
+                           self.ffi_main.unpack(angles, count)))
+        return samples, ad.error_count
     # API interface
     def _api_update(self, eventtime):
         if self.sensor_helper.is_tcode_absolute:
@@ -533,7 +508,7 @@ class Angle:
         samples, error_count = self._extract_samples(raw_samples)
         if not samples:
             return {}
-        offset = self.calibration.apply_calibration(samples)
+        offset = self.calibration.get_position_offset(samples)
         return {'data': samples, 'errors': error_count,
                 'position_offset': offset}
     def _start_measurements(self):
@@ -544,12 +519,14 @@ class Angle:
         # Start bulk reading
         with self.lock:
             self.raw_samples = []
-        self.last_sequence = 0
+        self.decode_state.last_sequence = 0
         systime = self.printer.get_reactor().monotonic()
         print_time = self.mcu.estimated_print_time(systime) + MIN_MSG_TIME
         self.start_clock = reqclock = self.mcu.print_time_to_clock(print_time)
         rest_ticks = self.mcu.seconds_to_clock(self.sample_period)
         self.sample_ticks = rest_ticks
+        self.decode_state.start_clock = reqclock
+        self.decode_state.sample_ticks = rest_ticks
         self.query_spi_angle_cmd.send([self.oid, reqclock, rest_ticks,
                                        self.time_shift], reqclock=reqclock)
     def _finish_measurements(self):
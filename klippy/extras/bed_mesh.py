@@ -5,6 +5,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, math, json, collections
+import chelper
 from . import probe
 
 PROFILE_VERSION = 1
@@ -31,10 +32,6 @@ def within(coord, min_c, max_c, tol=0.0):
 def constrain(val, min_val, max_val):
     return min(max_val, max(min_val, val))
 
-# Linear interpolation between two values
-def lerp(t, v0, v1):
-    return (1. - t) * v0 + t * v1
-
 # retreive commma separated pair from config
 def parse_config_pair(config, option, default, minval=None, maxval=None):
     pair = config.getintlist(option, (default, default))
@@ -103,6 +100,8 @@ class BedMesh:
         self.log_fade_complete = False
         self.base_fade_target = config.getfloat('fade_target', None)
         self.fade_target = 0.
+        self.dense_mesh_spacing = config.getfloat(
+            'dense_mesh_spacing', None, minval=1.)
         self.gcode = self.printer.lookup_object('gcode')
         self.splitter = MoveSplitter(config, self.gcode)
         # setup persistent storage
@@ -129,6 +128,8 @@ class BedMesh:
         self.bmc.print_generated_points(logging.info)
         self.pmgr.initialize()
     def set_mesh(self, mesh):
+        if mesh is not None and self.dense_mesh_spacing is not None:
+            mesh.build_dense_grid(self.dense_mesh_spacing)
         if mesh is not None and self.fade_end != self.FADE_DISABLE:
             self.log_fade_complete = True
             if self.base_fade_target is None:
@@ -206,14 +207,10 @@ class BedMesh:
                     % (z, self.fade_target))
             self.toolhead.move([x, y, z + self.fade_target, e], speed)
         else:
-            self.splitter.build_move(self.last_position, newpos, factor)
-            while not self.splitter.traverse_complete:
-                split_move = self.splitter.split()
-                if split_move:
-                    self.toolhead.move(split_move, speed)
-                else:
-                    raise self.gcode.error(
-                        "Mesh Leveling: Error splitting move ")
+            split_moves = self.splitter.split_move(
+                self.last_position, newpos, factor)
+            for split_move in split_moves:
+                self.toolhead.move(split_move, speed)
         self.last_position[:] = newpos
     def get_status(self, eventtime=None):
         status = {
@@ -747,59 +744,29 @@ class MoveSplitter:
         self.z_mesh = None
         self.fade_offset = 0.
         self.gcode = gcode
+        self.ffi_main, self.ffi_lib = chelper.get_ffi()
+        self.max_moves = 16
+        self.split_out = self.ffi_main.new('double[]', self.max_moves * 4)
     def initialize(self, mesh, fade_offset):
         self.z_mesh = mesh
         self.fade_offset = fade_offset
-    def build_move(self, prev_pos, next_pos, factor):
-        self.prev_pos = tuple(prev_pos)
-        self.next_pos = tuple(next_pos)
-        self.current_pos = list(prev_pos)
-        self.z_factor = factor
-        self.z_offset = self._calc_z_offset(prev_pos)
-        self.traverse_complete = False
-        self.distance_checked = 0.
-        axes_d = [self.next_pos[i] - self.prev_pos[i] for i in range(4)]
-        self.total_move_length = math.sqrt(sum([d*d for d in axes_d[:3]]))
-        self.axis_move = [not isclose(d, 0., abs_tol=1e-10) for d in axes_d]
-    def _calc_z_offset(self, pos):
-        z = self.z_mesh.calc_z(pos[0], pos[1])
-        offset = self.fade_offset
-        return self.z_factor * (z - offset) + offset
-    def _set_next_move(self, distance_from_prev):
-        t = distance_from_prev / self.total_move_length
-        if t > 1. or t < 0.:
-            raise self.gcode.error(
-                "bed_mesh: Slice distance is negative "
-                "or greater than entire move length")
-        for i in range(4):
-            if self.axis_move[i]:
-                self.current_pos[i] = lerp(
-                    t, self.prev_pos[i], self.next_pos[i])
-    def split(self):
-        if not self.traverse_complete:
-            if self.axis_move[0] or self.axis_move[1]:
-                # X and/or Y axis move, traverse if necessary
-                while self.distance_checked + self.move_check_distance \
-                        < self.total_move_length:
-                    self.distance_checked += self.move_check_distance
-                    self._set_next_move(self.distance_checked)
-                    next_z = self._calc_z_offset(self.current_pos)
-                    if abs(next_z - self.z_offset) >= self.split_delta_z:
-                        self.z_offset = next_z
-                        return self.current_pos[0], self.current_pos[1], \
-                            self.current_pos[2] + self.z_offset, \
-                            self.current_pos[3]
-            # end of move reached
-            self.current_pos[:] = self.next_pos
-            self.z_offset = self._calc_z_offset(self.current_pos)
-            # Its okay to add Z-Offset to the final move, since it will not be
-            # used again.
-            self.current_pos[2] += self.z_offset
-            self.traverse_complete = True
-            return self.current_pos
-        else:
-            # Traverse complete
-            return None
+    def split_move(self, prev_pos, next_pos, factor):
+        # Split the move and apply the z adjustment in a single call
+        while 1:
+            count = self.ffi_lib.bed_mesh_split_move(
+                self.z_mesh.get_c_mesh(), prev_pos, next_pos, factor,
+                self.fade_offset, self.split_delta_z,
+                self.move_check_distance, self.split_out, self.max_moves)
+            if count < 0:
+                raise self.gcode.error(
+                    "bed_mesh: Slice distance is negative "
+                    "or greater than entire move length")
+            if count <= self.max_moves:
+                break
+            self.max_moves = count
+            self.split_out = self.ffi_main.new('double[]', count * 4)
+        data = self.ffi_main.unpack(self.split_out, count * 4)
+        return [data[i:i+4] for i in range(0, count * 4, 4)]
 
 
 class ZMesh:
@@ -808,6 +775,7 @@ class ZMesh:
         self.mesh_params = params
         self.avg_z = 0.
         self.mesh_offsets = [0., 0.]
+        self.c_mesh = None
         logging.debug('bed_mesh: probe/mesh parameters:')
         for key, value in self.mesh_params.items():
             logging.debug("%s :  %s" % (key, value))
@@ -894,22 +862,56 @@ class ZMesh:
         # z step distances
         self.avg_z = round(self.avg_z, 2)
         self.print_mesh(logging.debug)
+        self._set_lookup_grid(self.mesh_matrix, self.mesh_x_dist,
+                              self.mesh_y_dist)
+    def build_dense_grid(self, spacing):
+        # Precompute the interpolated mesh with points no further apart
+        # than 'spacing' and use it for z lookups
+        params = self.mesh_params
+        if self.probed_matrix is None or params['algo'] == 'direct':
+            return
+        pps = []
+        for axis in 'xy':
+            seg_len = ((params['max_' + axis] - params['min_' + axis])
+                       / (params[axis + '_count'] - 1))
+            pps.append(max(params['mesh_%s_pps' % (axis,)],
+                           int(math.ceil(seg_len / spacing)) - 1))
+        dense_params = dict(params)
+        dense_params['mesh_x_pps'], dense_params['mesh_y_pps'] = pps
+        dense = ZMesh(dense_params)
+        dense._sample(self.probed_matrix)
+        self._set_lookup_grid(dense.mesh_matrix, dense.mesh_x_dist,
+                              dense.mesh_y_dist)
+        logging.info("bed_mesh: Dense lookup grid size - X:%d, Y:%d"
+                     % (dense.mesh_x_count, dense.mesh_y_count))
+    def _set_lookup_grid(self, matrix, x_dist, y_dist):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        c_mesh = ffi_main.gc(ffi_lib.bed_mesh_alloc(len(matrix[0]),
+                                                    len(matrix)),
+                             ffi_lib.bed_mesh_free)
+        ffi_lib.bed_mesh_set_geometry(c_mesh, self.mesh_x_min, x_dist,
+                                      self.mesh_y_min, y_dist)
+        for i, line in enumerate(matrix):
+            ffi_lib.bed_mesh_set_row(c_mesh, i, line)
+        ffi_lib.bed_mesh_set_offsets(c_mesh, *self.mesh_offsets)
+        self.c_mesh = c_mesh
+    def get_c_mesh(self):
+        return self.c_mesh
     def set_mesh_offsets(self, offsets):
         for i, o in enumerate(offsets):
             if o is not None:
                 self.mesh_offsets[i] = o
+        if self.c_mesh is not None:
+            ffi_main, ffi_lib = chelper.get_ffi()
+            ffi_lib.bed_mesh_set_offsets(self.c_mesh, *self.mesh_offsets)
     def get_x_coordinate(self, index):
         return self.mesh_x_min + self.mesh_x_dist * index
     def get_y_coordinate(self, index):
         return self.mesh_y_min + self.mesh_y_dist * index
     def calc_z(self, x, y):
-        if self.mesh_matrix is not None:
-            tbl = self.mesh_matrix
-            tx, xidx = self._get_linear_index(x + self.mesh_offsets[0], 0)
-            ty, yidx = self._get_linear_index(y + self.mesh_offsets[1], 1)
-            z0 = lerp(tx, tbl[yidx][xidx], tbl[yidx][xidx+1])
-            z1 = lerp(tx, tbl[yidx+1][xidx], tbl[yidx+1][xidx+1])
-            return lerp(ty, z0, z1)
+        if self.c_mesh is not None:
+            ffi_main, ffi_lib = chelper.get_ffi()
+            return ffi_lib.bed_mesh_calc_z(self.c_mesh, x, y)
         else:
             # No mesh table generated, no z-adjustment
             return 0.
@@ -920,24 +922,6 @@ class ZMesh:
             return mesh_min, mesh_max
         else:
             return 0., 0.
-    def _get_linear_index(self, coord, axis):
-        if axis == 0:
-            # X-axis
-            mesh_min = self.mesh_x_min
-            mesh_cnt = self.mesh_x_count
-            mesh_dist = self.mesh_x_dist
-            cfunc = self.get_x_coordinate
-        else:
-            # Y-axis
-            mesh_min = self.mesh_y_min
-            mesh_cnt = self.mesh_y_count
-            mesh_dist = self.mesh_y_dist
-            cfunc = self.get_y_coordinate
-        t = 0.
-        idx = int(math.floor((coord - mesh_min) / mesh_dist))
-        idx = constrain(idx, 0, mesh_cnt - 2)
-        t = (coord - cfunc(idx)) / mesh_dist
-        return constrain(t, 0., 1.), idx
     def _sample_direct(self, z_matrix):
         self.mesh_matrix = z_matrix
     def _sample_lagrange(self, z_matrix):
@@ -50,7 +50,7 @@ class ForceMove:
                                    self.cmd_SET_KINEMATIC_POSITION,
                                    desc=self.cmd_SET_KINEMATIC_POSITION_help)
     def register_stepper(self, config, mcu_stepper):
-        self.steppers[mcu_stepper.get_name()] = mcu_stepper
+        self.steppers[config.get_name()] = mcu_stepper
     def lookup_stepper(self, name):
         if name not in self.steppers:
             raise self.printer.config_error("Unknown stepper %s" % (name,))
@@ -95,7 +95,12 @@ class ForceMove:
         name = gcmd.get('STEPPER')
         if name not in self.steppers:
             raise gcmd.error("Unknown stepper %s" % (name,))
-        return self.steppers[name]
+        stepper = self.steppers[name]
+        if stepper.get_name() != name:
+            raise gcmd.error("Stepper %s is in the step_group of %s and can"
+                             " not be moved separately"
+                             % (name, stepper.get_name()))
+        return stepper
     cmd_STEPPER_BUZZ_help = "Oscillate a given stepper to help id it"
     def cmd_STEPPER_BUZZ(self, gcmd):
         stepper = self._lookup_stepper(gcmd)
@@ -5,6 +5,10 @@
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging
 
+# Bit positions of the X, Y, Z, E, and F parameters in a 'gcode_params' mask
+AXIS_BITS = [ord(a) - ord('A') for a in 'XYZE']
+F_BIT = ord('F') - ord('A')
+
 class GCodeMove:
     def __init__(self, config):
         self.printer = printer = config.get_printer()
@@ -33,6 +37,8 @@ class GCodeMove:
             desc = getattr(self, 'cmd_' + cmd + '_help', None)
             gcode.register_command(cmd, func, False, desc)
         gcode.register_command('G0', self.cmd_G1)
+        gcode.register_fast_command('G0', self._fast_G1)
+        gcode.register_fast_command('G1', self._fast_G1)
         gcode.register_command('M114', self.cmd_M114, True)
         gcode.register_command('GET_POSITION', self.cmd_GET_POSITION, True,
                                desc=self.cmd_GET_POSITION_help)
@@ -141,6 +147,43 @@ class GCodeMove:
             raise gcmd.error("Unable to parse move '%s'"
                              % (gcmd.get_commandline(),))
         self.move_with_transform(self.last_position, self.speed)
+    def _fast_G1(self, commandline, gparams):
+        # Move (with parameters from the native gcode_parse_move() parser)
+        mask = gparams.mask
+        values = gparams.values
+        for pos, bit in enumerate(AXIS_BITS):
+            if mask & (1 << bit):
+                v = values[bit]
+                if pos == 3:
+                    v *= self.extrude_factor
+                    if self.absolute_coord and self.absolute_extrude:
+                        self.last_position[3] = v + self.base_position[3]
+                        continue
+                elif self.absolute_coord:
+                    self.last_position[pos] = v + self.base_position[pos]
+                    continue
+                self.last_position[pos] += v
+        if mask & (1 << F_BIT):
+            gcode_speed = values[F_BIT]
+            if gcode_speed <= 0.:
+                raise self.printer.command_error("Invalid speed in '%s'"
+                                                 % (commandline,))
+            self.speed = gcode_speed * self.speed_factor
+        self.move_with_transform(self.last_position, self.speed)
+    def move_path(self, coords, e_dist, gcode_speed=None):
+        # Move through a list of absolute (x, y, z) coordinates with
+        # the extrusion 'e_dist' spread evenly along them
+        if gcode_speed is not None:
+            self.speed = gcode_speed * self.speed_factor
+        base_x, base_y, base_z = self.base_position[:3]
+        e_per_move = e_dist * self.extrude_factor / len(coords)
+        pos = self.last_position
+        for x, y, z in coords:
+            pos[0] = x + base_x
+            pos[1] = y + base_y
+            pos[2] = z + base_z
+            pos[3] += e_per_move
+            self.move_with_transform(pos, self.speed)
     # G-Code coordinate manipulation
     def cmd_G20(self, gcmd):
         # Set units to inches
@@ -86,7 +86,15 @@ class APIDumpHelper:
 class InternalDumpClient:
     def __init__(self):
         self.msgs = []
+        self.msg_cb = None
         self.is_done = False
+    def set_message_callback(self, msg_cb):
+        # Deliver messages to msg_cb instead of storing them
+        self.msg_cb = msg_cb
+        msgs = self.msgs
+        self.msgs = []
+        for msg in msgs:
+            msg_cb(msg)
     def get_messages(self):
         return self.msgs
     def finalize(self):
@@ -94,6 +102,9 @@ class InternalDumpClient:
     def is_closed(self):
         return self.is_done
     def send(self, msg):
+        if self.msg_cb is not None:
+            self.msg_cb(msg)
+            return
         self.msgs.append(msg)
         if len(self.msgs) >= 10000:
             # Avoid filling up memory with too many samples
@@ -168,27 +168,33 @@ class ResonanceTester:
                 for chip_axis, chip in self.accel_chips:
                     if axis.matches(chip_axis):
                         aclient = chip.start_internal_client()
-                        raw_values.append((chip_axis, aclient))
+                        psd = None
+                        if helper is not None and raw_name_suffix is None:
+                            # Calculate the spectrum while the test runs
+                            psd = helper.create_psd_accumulator()
+                            aclient.stream_samples(psd.add_samples)
+                        raw_values.append((chip_axis, aclient, psd))
                 # Generate moves
                 self.test.run_test(axis, gcmd)
-                for chip_axis, aclient in raw_values:
+                for chip_axis, aclient, psd in raw_values:
                     aclient.finish_measurements()
                     if raw_name_suffix is not None:
                         raw_name = self.get_filename(
                                 'raw_data', raw_name_suffix, axis,
                                 point if len(test_points) > 1 else None)
-                        aclient.write_to_file(raw_name)
+                        raw_name = aclient.write_to_file(raw_name)
                         gcmd.respond_info(
                                 "Writing raw accelerometer data to "
                                 "%s file" % (raw_name,))
                 if helper is None:
                     continue
-                for chip_axis, aclient in raw_values:
+                for chip_axis, aclient, psd in raw_values:
                     if not aclient.has_valid_samples():
                         raise gcmd.error(
                                 "%s-axis accelerometer measured no data" % (
                                     chip_axis,))
-                    new_data = helper.process_accelerometer_data(aclient)
+                    new_data = helper.process_accelerometer_data(
+                            psd if psd is not None else aclient)
                     if calibration_data[axis] is None:
                         calibration_data[axis] = new_data
                     else:
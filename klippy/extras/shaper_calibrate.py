@@ -9,6 +9,7 @@ shaper_defs = importlib.import_module('.shaper_defs', 'extras')
 MIN_FREQ = 5.
 MAX_FREQ = 200.
 WINDOW_T_SEC = 0.5
+RATE_ESTIMATE_T_SEC = 1.
 MAX_SHAPER_FREQ = 150.
 
 TEST_DAMPING_RATIOS=[0.075, 0.1, 0.15]
@@ -53,6 +54,81 @@ class CalibrationData:
         return self._psd_map[axis]
 
 
+# Incremental calculation of the power spectral density (using Welch's
+# algorithm) of accelerometer samples as they are received.  Only the
+# running sum of the window spectra and the samples of the last
+# (incomplete) window are kept in memory.
+class PSDAccumulator:
+    def __init__(self, numpy):
+        self.numpy = numpy
+        self.count = 0
+        self.first_time = self.last_time = 0.
+        self.pending = numpy.zeros((0, 3))
+        self.window_size = 0
+        self.window = self.psd_sums = None
+        self.num_windows = 0
+    def _setup_window(self):
+        np = self.numpy
+        # The window size is chosen from the initial sampling rate
+        sampling_freq = self.count / (self.last_time - self.first_time)
+        M = 1 << int(sampling_freq * WINDOW_T_SEC - 1).bit_length()
+        self.window_size = M
+        self.window = np.kaiser(M, 6.)
+        self.psd_sums = np.zeros((3, M // 2 + 1))
+    def _process_windows(self):
+        np = self.numpy
+        M = self.window_size
+        step = M - M // 2
+        n_windows = (self.pending.shape[0] - M // 2) // step
+        if n_windows <= 0:
+            return
+        for axis in range(3):
+            x = self.pending[:n_windows * step + M // 2, axis]
+            shape = (M, n_windows)
+            strides = (x.strides[-1], step * x.strides[-1])
+            x = np.lib.stride_tricks.as_strided(
+                    x, shape=shape, strides=strides, writeable=False)
+            # Detrend, apply windowing function, and calculate the FFT
+            x = self.window[:, None] * (x - np.mean(x, axis=0))
+            result = np.fft.rfft(x, n=M, axis=0)
+            self.psd_sums[axis] += (np.conjugate(result) * result).real.sum(
+                    axis=-1)
+        self.num_windows += n_windows
+        self.pending = self.pending[n_windows * step:]
+    def add_samples(self, samples):
+        if not samples:
+            return
+        data = self.numpy.array(samples)
+        if not self.count:
+            self.first_time = data[0,0]
+        self.last_time = data[-1,0]
+        self.count += data.shape[0]
+        self.pending = self.numpy.concatenate((self.pending, data[:,1:]))
+        if not self.window_size:
+            if self.last_time - self.first_time < RATE_ESTIMATE_T_SEC:
+                return
+            self._setup_window()
+        self._process_windows()
+    def get_calibration_data(self):
+        np = self.numpy
+        if self.count < 2 or self.last_time <= self.first_time:
+            return None
+        if not self.window_size:
+            self._setup_window()
+            self._process_windows()
+        M = self.window_size
+        if self.count <= M or not self.num_windows:
+            return None
+        sampling_freq = self.count / (self.last_time - self.first_time)
+        # Compensation for windowing loss
+        scale = 1.0 / (self.window**2).sum()
+        psd = self.psd_sums * (scale / (sampling_freq * self.num_windows))
+        # Double the one-sided response, except for DC and Nyquist terms
+        psd[:,1:-1] *= 2.
+        freqs = np.fft.rfftfreq(M, 1. / sampling_freq)
+        return CalibrationData(freqs, psd[0]+psd[1]+psd[2],
+                               psd[0], psd[1], psd[2])
+
 CalibrationResult = collections.namedtuple(
         'CalibrationResult',
         ('name', 'freq', 'vals', 'vibrs', 'smoothing', 'score', 'max_accel'))
@@ -69,13 +145,12 @@ class ShaperCalibrate:
                     "installed via `~/klippy-env/bin/pip install` (refer to "
                     "docs/Measuring_Resonances.md for more details).")
 
-    def background_process_exec(self, method, args):
-        if self.printer is None:
-            return method(*args)
-        import queuelogger
+    def _start_process(self, method, args):
         parent_conn, child_conn = multiprocessing.Pipe()
         def wrapper():
-            queuelogger.clear_bg_logging()
+            if self.printer is not None:
+                import queuelogger
+                queuelogger.clear_bg_logging()
             try:
                 res = method(*args)
             except:
@@ -84,26 +159,46 @@ class ShaperCalibrate:
                 return
             child_conn.send((False, res))
             child_conn.close()
-        # Start a process to perform the calculation
         calc_proc = multiprocessing.Process(target=wrapper)
         calc_proc.daemon = True
         calc_proc.start()
-        # Wait for the process to finish
-        reactor = self.printer.get_reactor()
-        gcode = self.printer.lookup_object("gcode")
-        eventtime = last_report_time = reactor.monotonic()
-        while calc_proc.is_alive():
-            if eventtime > last_report_time + 5.:
-                last_report_time = eventtime
-                gcode.respond_info("Wait for calculations..", log=False)
-            eventtime = reactor.pause(eventtime + .1)
+        return calc_proc, parent_conn
+
+    def background_process_exec(self, method, args):
+        return self.background_process_exec_all([(method, args)])[0]
+
+    def background_process_exec_all(self, jobs):
+        # Run each (method, args) job in its own process (so that they
+        # can run in parallel) and return the list of their results
+        if self.printer is None and len(jobs) == 1:
+            method, args = jobs[0]
+            return [method(*args)]
+        # Start a process for each calculation
+        procs = [self._start_process(method, args) for method, args in jobs]
+        if self.printer is not None:
+            # Wait for the processes to finish
+            reactor = self.printer.get_reactor()
+            gcode = self.printer.lookup_object("gcode")
+            eventtime = last_report_time = reactor.monotonic()
+            while any([calc_proc.is_alive() and not parent_conn.poll()
+                       for calc_proc, parent_conn in procs]):
+                if eventtime > last_report_time + 5.:
+                    last_report_time = eventtime
+                    gcode.respond_info("Wait for calculations..", log=False)
+                eventtime = reactor.pause(eventtime + .1)
         # Return results
-        is_err, res = parent_conn.recv()
-        if is_err:
-            raise self.error("Error in remote calculation: %s" % (res,))
-        calc_proc.join()
-        parent_conn.close()
-        return res
+        results = []
+        for calc_proc, parent_conn in procs:
+            try:
+                is_err, res = parent_conn.recv()
+            except EOFError:
+                is_err, res = True, "Calculation process exited unexpectedly"
+            calc_proc.join()
+            parent_conn.close()
+            if is_err:
+                raise self.error("Error in remote calculation: %s" % (res,))
+            results.append(res)
+        return results
 
     def _split_into_windows(self, x, window_size, overlap):
         # Memory-efficient algorithm to split an input 'x' into a series
@@ -149,16 +244,20 @@ class ShaperCalibrate:
         np = self.numpy
         if raw_values is None:
             return None
-        if isinstance(raw_values, np.ndarray):
-            data = raw_values
+        if isinstance(raw_values, tuple):
+            # Columns of time, accel_x, accel_y, accel_z
+            columns = raw_values
+        elif isinstance(raw_values, np.ndarray):
+            columns = raw_values.T
         else:
             samples = raw_values.get_samples()
             if not samples:
                 return None
-            data = np.array(samples)
+            columns = np.array(samples).T
 
-        N = data.shape[0]
-        T = data[-1,0] - data[0,0]
+        times = columns[0]
+        N = times.shape[0]
+        T = times[-1] - times[0]
         SAMPLING_FREQ = N / T
         # Round up to the nearest power of 2 for faster FFT
         M = 1 << int(SAMPLING_FREQ * WINDOW_T_SEC - 1).bit_length()
@@ -167,45 +266,42 @@ class ShaperCalibrate:
 
         # Calculate PSD (power spectral density) of vibrations per
         # frequency bins (the same bins for X, Y, and Z)
-        fx, px = self._psd(data[:,1], SAMPLING_FREQ, M)
-        fy, py = self._psd(data[:,2], SAMPLING_FREQ, M)
-        fz, pz = self._psd(data[:,3], SAMPLING_FREQ, M)
+        fx, px = self._psd(columns[1], SAMPLING_FREQ, M)
+        fy, py = self._psd(columns[2], SAMPLING_FREQ, M)
+        fz, pz = self._psd(columns[3], SAMPLING_FREQ, M)
         return CalibrationData(fx, px+py+pz, px, py, pz)
 
+    def create_psd_accumulator(self):
+        return PSDAccumulator(self.numpy)
+
     def process_accelerometer_data(self, data):
-        calibration_data = self.background_process_exec(
-                self.calc_freq_response, (data,))
+        if isinstance(data, PSDAccumulator):
+            # Spectrum was already calculated while the data was received
+            calibration_data = data.get_calibration_data()
+        else:
+            calibration_data = self.background_process_exec(
+                    self.calc_freq_response, (data,))
         if calibration_data is None:
             raise self.error(
                     "Internal error processing accelerometer data %s" % (data,))
         calibration_data.set_numpy(self.numpy)
         return calibration_data
 
-    def _estimate_shaper(self, shaper, test_damping_ratio, test_freqs):
+    def _estimate_shapers(self, A, T, test_damping_ratios, test_freqs):
+        # Calculate the residual vibrations of each shaper (rows of A
+        # and T) for each damping ratio and frequency in a single batch
         np = self.numpy
 
-        A, T = np.array(shaper[0]), np.array(shaper[1])
-        inv_D = 1. / A.sum()
-
-        omega = 2. * math.pi * test_freqs
-        damping = test_damping_ratio * omega
-        omega_d = omega * math.sqrt(1. - test_damping_ratio**2)
-        W = A * np.exp(np.outer(-damping, (T[-1] - T)))
-        S = W * np.sin(np.outer(omega_d, T))
-        C = W * np.cos(np.outer(omega_d, T))
-        return np.sqrt(S.sum(axis=1)**2 + C.sum(axis=1)**2) * inv_D
-
-    def _estimate_remaining_vibrations(self, shaper, test_damping_ratio,
-                                       freq_bins, psd):
-        vals = self._estimate_shaper(shaper, test_damping_ratio, freq_bins)
-        # The input shaper can only reduce the amplitude of vibrations by
-        # SHAPER_VIBRATION_REDUCTION times, so all vibrations below that
-        # threshold can be igonred
-        vibr_threshold = psd.max() / shaper_defs.SHAPER_VIBRATION_REDUCTION
-        remaining_vibrations = self.numpy.maximum(
-                vals * psd - vibr_threshold, 0).sum()
-        all_vibrations = self.numpy.maximum(psd - vibr_threshold, 0).sum()
-        return (remaining_vibrations / all_vibrations, vals)
+        inv_D = 1. / A.sum(axis=-1)
+        dr = np.array(test_damping_ratios)[:, None, None, None]
+        omega = 2. * math.pi * test_freqs[None, None, :, None]
+        damping = dr * omega
+        omega_d = omega * np.sqrt(1. - dr**2)
+        W = A[None, :, None, :] * np.exp(
+                -damping * (T[:, -1:] - T)[None, :, None, :])
+        S = W * np.sin(omega_d * T[None, :, None, :])
+        C = W * np.cos(omega_d * T[None, :, None, :])
+        return np.sqrt(S.sum(axis=-1)**2 + C.sum(axis=-1)**2) * inv_D[:, None]
 
     def _get_shaper_smoothing(self, shaper, accel=5000, scv=5.):
         half_accel = accel * .5
@@ -227,54 +323,77 @@ class ShaperCalibrate:
         offset_180 *= inv_D
         return max(offset_90, offset_180)
 
+    def _get_shapers_smoothing(self, A, T, accel=5000, scv=5.):
+        # Vectorized version of _get_shaper_smoothing()
+        np = self.numpy
+        half_accel = accel * .5
+
+        inv_D = 1. / A.sum(axis=-1)
+        ts = (A * T).sum(axis=-1) * inv_D
+        dT = T - ts[:, None]
+        offset_90 = np.where(T >= ts[:, None],
+                             A * (scv + half_accel * dT) * dT, 0.).sum(axis=-1)
+        offset_180 = (A * half_accel * dT**2).sum(axis=-1)
+        offset_90 *= inv_D * math.sqrt(2.)
+        offset_180 *= inv_D
+        return np.maximum(offset_90, offset_180)
+
     def fit_shaper(self, shaper_cfg, calibration_data, max_smoothing):
         np = self.numpy
 
-        test_freqs = np.arange(shaper_cfg.min_freq, MAX_SHAPER_FREQ, .2)
+        test_freqs = np.arange(shaper_cfg.min_freq, MAX_SHAPER_FREQ, .2)[::-1]
 
         freq_bins = calibration_data.freq_bins
         psd = calibration_data.psd_sum[freq_bins <= MAX_FREQ]
         freq_bins = freq_bins[freq_bins <= MAX_FREQ]
 
-        best_res = None
-        results = []
-        for test_freq in test_freqs[::-1]:
-            shaper_vibrations = 0.
-            shaper_vals = np.zeros(shape=freq_bins.shape)
-            shaper = shaper_cfg.init_func(
-                    test_freq, shaper_defs.DEFAULT_DAMPING_RATIO)
-            shaper_smoothing = self._get_shaper_smoothing(shaper)
-            if max_smoothing and shaper_smoothing > max_smoothing and best_res:
-                return best_res
-            # Exact damping ratio of the printer is unknown, pessimizing
-            # remaining vibrations over possible damping values
-            for dr in TEST_DAMPING_RATIOS:
-                vibrations, vals = self._estimate_remaining_vibrations(
-                        shaper, dr, freq_bins, psd)
-                shaper_vals = np.maximum(shaper_vals, vals)
-                if vibrations > shaper_vibrations:
-                    shaper_vibrations = vibrations
-            max_accel = self.find_shaper_max_accel(shaper)
-            # The score trying to minimize vibrations, but also accounting
-            # the growth of smoothing. The formula itself does not have any
-            # special meaning, it simply shows good results on real user data
-            shaper_score = shaper_smoothing * (shaper_vibrations**1.5 +
-                                               shaper_vibrations * .2 + .01)
-            results.append(
-                    CalibrationResult(
-                        name=shaper_cfg.name, freq=test_freq, vals=shaper_vals,
-                        vibrs=shaper_vibrations, smoothing=shaper_smoothing,
-                        score=shaper_score, max_accel=max_accel))
-            if best_res is None or best_res.vibrs > results[-1].vibrs:
-                # The current frequency is better for the shaper.
-                best_res = results[-1]
+        # Evaluate all test frequencies and damping ratios at once
+        shapers = [shaper_cfg.init_func(test_freq,
+                                        shaper_defs.DEFAULT_DAMPING_RATIO)
+                   for test_freq in test_freqs]
+        A = np.array([shaper[0] for shaper in shapers])
+        T = np.array([shaper[1] for shaper in shapers])
+        all_smoothing = self._get_shapers_smoothing(A, T)
+        vals = self._estimate_shapers(A, T, TEST_DAMPING_RATIOS, freq_bins)
+        # The input shaper can only reduce the amplitude of vibrations by
+        # SHAPER_VIBRATION_REDUCTION times, so all vibrations below that
+        # threshold can be igonred
+        vibr_threshold = psd.max() / shaper_defs.SHAPER_VIBRATION_REDUCTION
+        remaining_vibrations = np.maximum(
+                vals * psd - vibr_threshold, 0).sum(axis=-1)
+        all_vibrations = np.maximum(psd - vibr_threshold, 0).sum()
+        # Exact damping ratio of the printer is unknown, pessimizing
+        # remaining vibrations over possible damping values
+        all_vibrs = (remaining_vibrations / all_vibrations).max(axis=0)
+        all_vals = vals.max(axis=0)
+        # The score trying to minimize vibrations, but also accounting
+        # the growth of smoothing. The formula itself does not have any
+        # special meaning, it simply shows good results on real user data
+        all_scores = all_smoothing * (all_vibrs**1.5 + all_vibrs * .2 + .01)
+
+        def get_result(i):
+            return CalibrationResult(
+                    name=shaper_cfg.name, freq=test_freqs[i], vals=all_vals[i],
+                    vibrs=all_vibrs[i], smoothing=all_smoothing[i],
+                    score=all_scores[i],
+                    max_accel=self.find_shaper_max_accel(shapers[i]))
+        # Test frequencies are checked from the highest to the lowest one
+        # until the shaper smoothing exceeds max_smoothing
+        num_freqs = len(test_freqs)
+        if max_smoothing:
+            over_smoothing = np.nonzero(all_smoothing[1:] > max_smoothing)[0]
+            if len(over_smoothing):
+                num_freqs = over_smoothing[0] + 1
+                return get_result(np.argmin(all_vibrs[:num_freqs]))
+        best = np.argmin(all_vibrs)
         # Try to find an 'optimal' shapper configuration: the one that is not
         # much worse than the 'best' one, but gives much less smoothing
-        selected = best_res
-        for res in results[::-1]:
-            if res.vibrs < best_res.vibrs * 1.1 and res.score < selected.score:
-                selected = res
-        return selected
+        selected = best
+        vibrs, scores = all_vibrs.tolist(), all_scores.tolist()
+        for i in range(num_freqs-1, -1, -1):
+            if vibrs[i] < vibrs[best] * 1.1 and scores[i] < scores[selected]:
+                selected = i
+        return get_result(selected)
 
     def _bisect(self, func):
         left = right = 1.
@@ -303,11 +422,12 @@ class ShaperCalibrate:
     def find_best_shaper(self, calibration_data, max_smoothing, logger=None):
         best_shaper = None
         all_shapers = []
-        for shaper_cfg in shaper_defs.INPUT_SHAPERS:
-            if shaper_cfg.name not in AUTOTUNE_SHAPERS:
-                continue
-            shaper = self.background_process_exec(self.fit_shaper, (
-                shaper_cfg, calibration_data, max_smoothing))
+        # Fit all shapers in parallel
+        shapers = self.background_process_exec_all([
+            (self.fit_shaper, (shaper_cfg, calibration_data, max_smoothing))
+            for shaper_cfg in shaper_defs.INPUT_SHAPERS
+            if shaper_cfg.name in AUTOTUNE_SHAPERS])
+        for shaper in shapers:
             if logger is not None:
                 logger("Fitted shaper '%s' frequency = %.1f Hz "
                        "(vibrations = %.1f%%, smoothing ~= %.3f)" % (
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import os, time, logging
+import reactor
 
 class PrinterSysStats:
     def __init__(self, config):
@@ -56,6 +57,9 @@ class PrinterStats:
         self.stats_timer = reactor.register_timer(self.generate_stats)
         self.stats_cb = []
         self.printer.register_event_handler("klippy:ready", self.handle_ready)
+        gcode = self.printer.lookup_object('gcode')
+        gcode.register_command("TIMER_PROFILE", self.cmd_TIMER_PROFILE,
+                               desc=self.cmd_TIMER_PROFILE_help)
     def handle_ready(self):
         self.stats_cb = [o.stats for n, o in self.printer.lookup_objects()
                          if hasattr(o, 'stats')]
@@ -68,6 +72,27 @@ class PrinterStats:
             logging.info("Stats %.1f: %s", eventtime,
                          ' '.join([s[1] for s in stats]))
         return eventtime + 1.
+    cmd_TIMER_PROFILE_help = "Enable or report host timer callback profiling"
+    def cmd_TIMER_PROFILE(self, gcmd):
+        reactor_obj = self.printer.get_reactor()
+        enable = gcmd.get_int('ENABLE', None, minval=0, maxval=1)
+        if enable is not None:
+            reactor_obj.set_timer_profiling(enable)
+            gcmd.respond_info("Timer profiling %s"
+                              % (["disabled", "enabled"][enable],))
+            return
+        profiles = reactor_obj.get_timer_profiles()
+        if not profiles:
+            gcmd.respond_info("No timer profile data (use ENABLE=1)")
+            return
+        buckets = ["<%.3g" % (b * 1000.,) for b in reactor.PROFILE_BUCKETS]
+        buckets.append(">=%.3g" % (reactor.PROFILE_BUCKETS[-1] * 1000.,))
+        msg = ["Timer callback runtimes (ms): %s" % (" ".join(buckets),)]
+        for p in profiles:
+            msg.append("%s: count=%d avg=%.3f max=%.3f hist=%s" % (
+                p.name, p.count, p.total_time * 1000. / p.count,
+                p.max_time * 1000., " ".join(map(str, p.histogram))))
+        gcmd.respond_info("\n".join(msg))
 
 def load_config(config):
     config.get_printer().add_object('system_stats', PrinterSysStats(config))
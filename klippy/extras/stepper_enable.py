@@ -85,7 +85,7 @@ class PrinterStepperEnable:
                                self.cmd_SET_STEPPER_ENABLE,
                                desc=self.cmd_SET_STEPPER_ENABLE_help)
     def register_stepper(self, config, mcu_stepper):
-        name = mcu_stepper.get_name()
+        name = config.get_name()
         enable = setup_enable_pin(self.printer, config.get('enable_pin', None))
         self.enable_lines[name] = EnableTracking(mcu_stepper, enable)
     def motor_off(self):
@@ -297,7 +297,7 @@ class TMCCommandHelper:
         reg = self.mcu_tmc.get_register(self.fields.lookup_register(field_name))
         return self.fields.get_field(field_name, reg)
     def _handle_sync_mcu_pos(self, stepper):
-        if stepper.get_name() != self.stepper_name:
+        if stepper is not self.stepper:
             return
         try:
             driver_phase = self._query_phase()
@@ -3,9 +3,123 @@
 # Copyright (C) 2018  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import os, logging
+import os, logging, threading, queue, struct
 
-VALID_GCODE_EXTS = ['gcode', 'g', 'gco']
+VALID_GCODE_EXTS = ['gcode', 'g', 'gco', 'kgc']
+
+READ_SIZE = 8192
+READ_AHEAD_CHUNKS = 32
+
+# Background thread that reads and splits the file ahead of the print
+class FileReadAhead:
+    EOF = "eof"
+    ERROR = "error"
+    def __init__(self, current_file, position):
+        self.current_file = current_file
+        current_file.seek(position)
+        self.chunks = queue.Queue(READ_AHEAD_CHUNKS)
+        self.is_running = True
+        self.bg_thread = threading.Thread(target=self._bg_thread)
+        self.bg_thread.daemon = True
+        self.bg_thread.start()
+    def _put(self, item):
+        while self.is_running:
+            try:
+                self.chunks.put(item, timeout=0.100)
+                return
+            except queue.Full:
+                pass
+    def _split(self, partial_input, data):
+        lines = data.split('\n')
+        lines[0] = partial_input + lines[0]
+        partial_input = lines.pop()
+        return lines, partial_input
+    def _bg_thread(self):
+        partial_input = self.current_file.read(0)
+        while self.is_running:
+            try:
+                data = self.current_file.read(READ_SIZE)
+            except:
+                logging.exception("virtual_sdcard read")
+                self._put(self.ERROR)
+                return
+            if not data:
+                self._put(self.EOF)
+                return
+            lines, partial_input = self._split(partial_input, data)
+            if lines:
+                lines.reverse()
+                self._put(lines)
+    def get_lines(self, wait=False):
+        # Return the next list of lines (in reverse order), EOF, ERROR,
+        # or None if the background thread has not caught up yet
+        try:
+            return self.chunks.get(wait)
+        except queue.Empty:
+            return None
+    def stop(self):
+        self.is_running = False
+        # Wake the thread if it is blocked on a full queue
+        try:
+            while 1:
+                self.chunks.get_nowait()
+        except queue.Empty:
+            pass
+        self.bg_thread.join()
+
+# Compiled gcode files (see scripts/compile_gcode.py) are a sequence of
+# records.  A text record is a zero byte, a 16bit little-endian length,
+# and a line of gcode.  A move record is a tag byte (bit 7 set, G-Code
+# number in bits 5-6, X/Y/Z/E/F parameter mask in bits 0-4) followed by
+# a little-endian double for each parameter.  Files start with a text
+# record containing BINARY_MAGIC.
+BINARY_MAGIC = b"; Klipper compiled gcode v1"
+BINARY_PARAMS = "XYZEF"
+
+def encode_text_record(line):
+    data = line.encode()
+    return struct.pack("<BH", 0, len(data)) + data
+
+def encode_move_record(gnum, params):
+    mask = 0
+    values = []
+    for i, p in enumerate(BINARY_PARAMS):
+        if p in params:
+            mask |= 1 << i
+            values.append(params[p])
+    tag = 0x80 | (gnum << 5) | mask
+    return struct.pack("<B%dd" % (len(values),), tag, *values)
+
+BINARY_HEADER = encode_text_record(BINARY_MAGIC.decode())
+
+def get_record_sizes():
+    sizes = []
+    for tag in range(256):
+        if tag & 0x80:
+            sizes.append(1 + 8 * bin(tag & 0x1f).count('1'))
+        else:
+            sizes.append(3)
+    return sizes
+
+# Background reader for compiled gcode files
+class BinaryReadAhead(FileReadAhead):
+    record_sizes = get_record_sizes()
+    def _split(self, partial_input, data):
+        data = partial_input + data
+        bdata = bytearray(data)
+        sizes = self.record_sizes
+        records = []
+        pos = 0
+        while pos < len(bdata):
+            tag = bdata[pos]
+            size = sizes[tag]
+            if not tag and pos + size <= len(bdata):
+                size += bdata[pos+1] | (bdata[pos+2] << 8)
+            if pos + size > len(bdata):
+                break
+            records.append(data[pos:pos+size])
+            pos += size
+        return records, data[pos:]
 
 class VirtualSD:
     def __init__(self, config):
@@ -23,6 +137,12 @@ class VirtualSD:
         self.must_pause_work = self.cmd_from_sd = False
         self.next_file_position = 0
         self.work_timer = None
+        self.file_reader = None
+        # Batch mode runs faster than real time - wait for the reader
+        self.is_fileinput = not not printer.get_start_args().get(
+            "debuginput")
+        self.is_binary = False
+        self.error_message = None
         # Register commands
         self.gcode = printer.lookup_object('gcode')
         for cmd in ['M20', 'M21', 'M23', 'M24', 'M25', 'M26', 'M27']:
@@ -38,6 +158,7 @@ class VirtualSD:
     def handle_shutdown(self):
         if self.work_timer is not None:
             self.must_pause_work = True
+            self._stop_reader()
             try:
                 readpos = max(self.file_position - 1024, 0)
                 readcount = self.file_position - readpos
@@ -111,6 +232,7 @@ class VirtualSD:
     def do_cancel(self):
         if self.current_file is not None:
             self.do_pause()
+            self._stop_reader()
             self.current_file.close()
             self.current_file = None
             self.print_stats.note_cancel()
@@ -121,6 +243,7 @@ class VirtualSD:
     def _reset_file(self):
         if self.current_file is not None:
             self.do_pause()
+            self._stop_reader()
             self.current_file.close()
             self.current_file = None
         self.file_position = self.file_size = 0.
@@ -171,7 +294,11 @@ class VirtualSD:
             if fname not in flist:
                 fname = files_by_lower[fname.lower()]
             fname = os.path.join(self.sdcard_dirname, fname)
-            f = open(fname, 'r')
+            f = open(fname, 'rb')
+            is_binary = f.read(len(BINARY_HEADER)) == BINARY_HEADER
+            if not is_binary:
+                f.close()
+                f = open(fname, 'r')
             f.seek(0, os.SEEK_END)
             fsize = f.tell()
             f.seek(0)
@@ -181,6 +308,7 @@ class VirtualSD:
         gcmd.respond_raw("File opened:%s Size:%d" % (filename, fsize))
         gcmd.respond_raw("File selected")
         self.current_file = f
+        self.is_binary = is_binary
         self.file_position = 0
         self.file_size = fsize
         self.print_stats.set_current_file(filename)
@@ -210,75 +338,106 @@ class VirtualSD:
     def is_cmd_from_sd(self):
         return self.cmd_from_sd
     # Background work timer
+    def _start_reader(self):
+        if self.is_binary:
+            return BinaryReadAhead(self.current_file, self.file_position)
+        return FileReadAhead(self.current_file, self.file_position)
+    def _stop_reader(self):
+        if self.file_reader is not None:
+            self.file_reader.stop()
+            self.file_reader = None
+    def _dispatch_lines(self, lines):
+        # Run commands from 'lines' while holding the gcode mutex.
+        # Returns True if the print should stop.
+        gcode_mutex = self.gcode.get_mutex()
+        if self.is_binary:
+            run_line = self.gcode.run_binary_record
+            line_end = 0
+        else:
+            run_line = self.gcode.run_script_from_command
+            line_end = 1
+        with gcode_mutex:
+            self.cmd_from_sd = True
+            while lines and not self.must_pause_work:
+                line = lines.pop()
+                next_file_position = self.file_position + len(line) + line_end
+                self.next_file_position = next_file_position
+                try:
+                    run_line(line)
+                except self.gcode.error as e:
+                    self.error_message = str(e)
+                    return True
+                except:
+                    logging.exception("virtual_sdcard dispatch")
+                    return True
+                self.cmd_from_sd = False
+                self.file_position = self.next_file_position
+                # Do we need to skip around?
+                if self.next_file_position != next_file_position:
+                    self._stop_reader()
+                    del lines[:]
+                    self.file_reader = self._start_reader()
+                    return False
+                # Let other requests obtain the gcode mutex
+                if gcode_mutex.has_waiters():
+                    return False
+                self.cmd_from_sd = True
+            self.cmd_from_sd = False
+        return False
     def work_handler(self, eventtime):
         logging.info("Starting SD card print (position %d)", self.file_position)
         self.reactor.unregister_timer(self.work_timer)
         try:
-            self.current_file.seek(self.file_position)
+            self.file_reader = self._start_reader()
         except:
             logging.exception("virtual_sdcard seek")
             self.work_timer = None
             return self.reactor.NEVER
         self.print_stats.note_start()
         gcode_mutex = self.gcode.get_mutex()
-        partial_input = ""
         lines = []
-        error_message = None
+        self.error_message = None
         while not self.must_pause_work:
             if not lines:
-                # Read more data
-                try:
-                    data = self.current_file.read(8192)
-                except:
-                    logging.exception("virtual_sdcard read")
+                # Obtain more data from the background reader
+                data = self.file_reader.get_lines(self.is_fileinput)
+                if data is None:
+                    # Reader has not caught up yet
+                    self.reactor.pause(self.reactor.monotonic() + 0.001)
+                    continue
+                if data is FileReadAhead.ERROR:
                     break
-                if not data:
+                if data is FileReadAhead.EOF:
                     # End of file
+                    self._stop_reader()
                     self.current_file.close()
                     self.current_file = None
                     logging.info("Finished SD card print")
                     self.gcode.respond_raw("Done printing file")
                     break
-                lines = data.split('\n')
-                lines[0] = partial_input + lines[0]
-                partial_input = lines.pop()
-                lines.reverse()
+                lines = data
                 self.reactor.pause(self.reactor.NOW)
                 continue
             # Pause if any other request is pending in the gcode class
             if gcode_mutex.test():
                 self.reactor.pause(self.reactor.monotonic() + 0.100)
                 continue
-            # Dispatch command
-            self.cmd_from_sd = True
-            line = lines.pop()
-            next_file_position = self.file_position + len(line) + 1
-            self.next_file_position = next_file_position
+            # Dispatch commands
             try:
-                self.gcode.run_script(line)
-            except self.gcode.error as e:
-                error_message = str(e)
-                break
+                if self._dispatch_lines(lines):
+                    break
             except:
-                logging.exception("virtual_sdcard dispatch")
-                break
-            self.cmd_from_sd = False
-            self.file_position = self.next_file_position
-            # Do we need to skip around?
-            if self.next_file_position != next_file_position:
-                try:
-                    self.current_file.seek(self.file_position)
-                except:
-                    logging.exception("virtual_sdcard seek")
-                    self.work_timer = None
-                    return self.reactor.NEVER
-                lines = []
-                partial_input = ""
+                logging.exception("virtual_sdcard seek")
+                self.file_reader = None
+                self.work_timer = None
+                self.cmd_from_sd = False
+                return self.reactor.NEVER
+        self._stop_reader()
         logging.info("Exiting SD card print (position %d)", self.file_position)
         self.work_timer = None
         self.cmd_from_sd = False
-        if error_message is not None:
-            self.print_stats.note_error(error_message)
+        if self.error_message is not None:
+            self.print_stats.note_error(self.error_message)
         elif self.current_file is not None:
             self.print_stats.note_pause()
         else:
@@ -4,12 +4,24 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import os, re, logging, collections, shlex
+import chelper
 
 class CommandError(Exception):
     pass
 
 Coord = collections.namedtuple('Coord', ('x', 'y', 'z', 'e'))
 
+# Commands that may be handled by the native gcode_parse_move() parser
+FAST_COMMANDS = ('G0', 'G1', 'G2', 'G3')
+
+# Format a parameter value as g-code text (g-code has no exponent
+# notation - "E5e-05" would be parsed as "E5 E-05")
+def format_param(value):
+    text = repr(value)
+    if 'e' in text:
+        text = ('%.20f' % (value,)).rstrip('0').rstrip('.')
+    return text
+
 class GCodeCommand:
     error = CommandError
     def __init__(self, gcode, command, commandline, params, need_ack):
@@ -104,6 +116,12 @@ class GCodeDispatch:
         self.ready_gcode_handlers = {}
         self.mux_commands = {}
         self.gcode_help = {}
+        self.fast_handlers = {}
+        # Native parser for simple move commands
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.fast_params = ffi_main.new('struct gcode_params *')
+        self.fast_parse = ffi_lib.gcode_parse_move
+        self.binary_decode = ffi_lib.gcode_decode_move
         # Register commands needed before config file is loaded
         handlers = ['M110', 'M112', 'M115',
                     'RESTART', 'FIRMWARE_RESTART', 'ECHO', 'STATUS', 'HELP']
@@ -126,6 +144,7 @@ class GCodeDispatch:
                 del self.ready_gcode_handlers[cmd]
             if cmd in self.base_gcode_handlers:
                 del self.base_gcode_handlers[cmd]
+            self.fast_handlers.pop(cmd, None)
             return old_cmd
         if cmd in self.ready_gcode_handlers:
             raise self.printer.config_error(
@@ -138,6 +157,14 @@ class GCodeDispatch:
             self.base_gcode_handlers[cmd] = func
         if desc is not None:
             self.gcode_help[cmd] = desc
+    def register_fast_command(self, cmd, fast_func):
+        # Register an alternate handler for G0-G3 commands that is
+        # invoked with natively parsed parameters (a 'gcode_params'
+        # struct) instead of a GCodeCommand object
+        if cmd not in FAST_COMMANDS or cmd not in self.ready_gcode_handlers:
+            raise self.printer.config_error(
+                "Can not register fast handler for gcode command %s" % (cmd,))
+        self.fast_handlers[cmd] = (self.ready_gcode_handlers[cmd], fast_func)
     def register_mux_command(self, cmd, key, value, func, desc=None):
         prev = self.mux_commands.get(cmd)
         if prev is None:
@@ -172,30 +199,52 @@ class GCodeDispatch:
         self._respond_state("Ready")
     # Parse input into commands
     args_r = re.compile('([A-Z_]+|[A-Z*/])')
+    def _lookup_fast_handler(self, line):
+        # Check if a simple move command can bypass the generic parser
+        if not self.fast_handlers:
+            return None, None
+        try:
+            gnum = self.fast_parse(self.fast_params, line.encode())
+        except UnicodeError:
+            return None, None
+        if gnum < 0:
+            return None, None
+        cmd = FAST_COMMANDS[gnum]
+        fh = self.fast_handlers.get(cmd)
+        if fh is None or self.gcode_handlers.get(cmd) is not fh[0]:
+            return None, None
+        return cmd, fh[1]
     def _process_commands(self, commands, need_ack=True):
         for line in commands:
             # Ignore comments and leading/trailing spaces
             line = origline = line.strip()
-            cpos = line.find(';')
-            if cpos >= 0:
-                line = line[:cpos]
-            # Break line into parts and determine command
-            parts = self.args_r.split(line.upper())
-            numparts = len(parts)
-            cmd = ""
-            if numparts >= 3 and parts[1] != 'N':
-                cmd = parts[1] + parts[2].strip()
-            elif numparts >= 5 and parts[1] == 'N':
-                # Skip line number at start of command
-                cmd = parts[3] + parts[4].strip()
-            # Build gcode "params" dictionary
-            params = { parts[i]: parts[i+1].strip()
-                       for i in range(1, numparts, 2) }
-            gcmd = GCodeCommand(self, cmd, origline, params, need_ack)
+            # Simple moves may be handled without building a GCodeCommand
+            gcmd = None
+            cmd, handler = self._lookup_fast_handler(line)
+            if handler is None:
+                cpos = line.find(';')
+                if cpos >= 0:
+                    line = line[:cpos]
+                # Break line into parts and determine command
+                parts = self.args_r.split(line.upper())
+                numparts = len(parts)
+                cmd = ""
+                if numparts >= 3 and parts[1] != 'N':
+                    cmd = parts[1] + parts[2].strip()
+                elif numparts >= 5 and parts[1] == 'N':
+                    # Skip line number at start of command
+                    cmd = parts[3] + parts[4].strip()
+                # Build gcode "params" dictionary
+                params = { parts[i]: parts[i+1].strip()
+                           for i in range(1, numparts, 2) }
+                gcmd = GCodeCommand(self, cmd, origline, params, need_ack)
+                handler = self.gcode_handlers.get(cmd, self.cmd_default)
             # Invoke handler for command
-            handler = self.gcode_handlers.get(cmd, self.cmd_default)
             try:
-                handler(gcmd)
+                if gcmd is None:
+                    handler(origline, self.fast_params)
+                else:
+                    handler(gcmd)
             except self.error as e:
                 self._respond_error(str(e))
                 self.printer.send_event("gcode:command_error")
@@ -208,7 +257,40 @@ class GCodeDispatch:
                 self._respond_error(msg)
                 if not need_ack:
                     raise
-            gcmd.ack()
+            if gcmd is not None:
+                gcmd.ack()
+            elif need_ack:
+                self.respond_raw("ok")
+    def run_binary_record(self, record):
+        # Run a record from a compiled gcode file (see virtual_sdcard.py)
+        gnum = self.binary_decode(self.fast_params, record, len(record))
+        if gnum < 0:
+            line = str(record[3:].decode())
+            self._process_commands([line], need_ack=False)
+            return
+        cmd = FAST_COMMANDS[gnum]
+        fh = self.fast_handlers.get(cmd)
+        if fh is None or self.gcode_handlers.get(cmd) is not fh[0]:
+            # Handler overridden - convert back to a text command
+            params = self.fast_params
+            line = cmd + "".join([" %s%s" % (chr(ord('A') + i),
+                                             format_param(params.values[i]))
+                                  for i in range(26)
+                                  if params.mask & (1 << i)])
+            self._process_commands([line], need_ack=False)
+            return
+        try:
+            fh[1](cmd, self.fast_params)
+        except self.error as e:
+            self._respond_error(str(e))
+            self.printer.send_event("gcode:command_error")
+            raise
+        except:
+            msg = 'Internal error on command:"%s"' % (cmd,)
+            logging.exception(msg)
+            self.printer.invoke_shutdown(msg)
+            self._respond_error(msg)
+            raise
     def run_script_from_command(self, script):
         self._process_commands(script.split('\n'), need_ack=False)
     def run_script(self, script):
@@ -555,6 +555,9 @@ class MCU:
             if not (self._serialport.startswith("/dev/rpmsg_")
                     or self._serialport.startswith("/tmp/klipper_host_")):
                 self._baud = config.getint('baud', 250000, minval=2400)
+        cache_dir = config.get('dictionary_cache_dir', None)
+        if cache_dir:
+            self._serial.set_dictionary_cache(os.path.expanduser(cache_dir))
         # Restarts
         restart_methods = [None, 'arduino', 'cheetah', 'command', 'rpi_usb']
         self._restart_method = 'command'
@@ -588,6 +591,14 @@ class MCU:
         self._mcu_tick_avg = 0.
         self._mcu_tick_stddev = 0.
         self._mcu_tick_awake = 0.
+        self._profile_timer_cmd = self._profile_task_cmd = None
+        self._profile_timer_count = 0
+        self._jitter_cmd = None
+        self._fw_stats_queries = []
+        self._fw_stats_pending = False
+        self._fw_stats_last = {}
+        self._fw_stats = ""
+        self._fw_stats_error = False
         # Register handlers
         printer.register_event_handler("klippy:connect", self._connect)
         printer.register_event_handler("klippy:mcu_identify",
@@ -604,6 +615,88 @@ class MCU:
         diff = count*tick_sumsq - tick_sum**2
         self._mcu_tick_stddev = c * math.sqrt(max(0., diff))
         self._mcu_tick_awake = tick_sum / self._mcu_freq
+    def _query_profile(self):
+        # Query firmware timer and task execution time statistics
+        entries = []
+        max_latency = 0
+        tasks = self.get_enumerations().get('task', {})
+        for name, task_id in sorted(tasks.items(), key=lambda t: t[1]):
+            params = self._profile_task_cmd.send([name])
+            entries.append(("task_" + name, params))
+        timer_count = self._profile_timer_count
+        idx = 0
+        while idx < timer_count:
+            params = self._profile_timer_cmd.send([idx])
+            idx += 1
+            func = params['func']
+            if not params['count']:
+                if not func:
+                    # No more entries - check the "other timers" entry
+                    idx = max(idx, timer_count - 1)
+                continue
+            name = "timer_%x" % (func,) if func else "timer_other"
+            entries.append((name, params))
+            max_latency = max(max_latency, params['max_latency'])
+        # Convert cumulative execution times to a load
+        stats = ["timer_latency=%.6f" % (max_latency / self._mcu_freq,)]
+        last = self._fw_stats_last
+        for name, params in entries:
+            rtime, tick_sum = params['#receive_time'], params['sum']
+            prev = last.get(name)
+            last[name] = (rtime, tick_sum)
+            if prev is None or rtime <= prev[0]:
+                continue
+            ticks = (tick_sum - prev[1]) & 0xffffffff
+            load = ticks / self._mcu_freq / (rtime - prev[0])
+            if load >= .0001:
+                stats.append("load_%s=%.4f" % (name, load))
+        return stats
+    def _query_jitter(self):
+        # Query the timer wake jitter histogram (buckets of power of
+        # two microseconds)
+        params = self._jitter_cmd.send()
+        data = bytearray(params['counts'])
+        counts = [data[i] | (data[i+1] << 8) | (data[i+2] << 16)
+                  | (data[i+3] << 24) for i in range(0, len(data), 4)]
+        stats = ["wake_jitter_max=%.6f" % (params['max'] / self._mcu_freq,)]
+        prev = self._fw_stats_last.get('jitter')
+        self._fw_stats_last['jitter'] = counts
+        if prev is None:
+            return stats
+        diffs = [(c - p) & 0xffffffff for c, p in zip(counts, prev)]
+        total = sum(diffs)
+        if not total:
+            return stats
+        # Report the upper limit of the bucket containing the 99th percentile
+        accum = 0
+        for bucket, count in enumerate(diffs):
+            accum += count
+            if accum >= total * .99:
+                break
+        p99 = (1 << bucket) * .000001
+        if bucket == len(diffs) - 1:
+            # The last bucket has no upper limit - use the maximum
+            p99 = params['max'] / self._mcu_freq
+        stats.append("wake_jitter_p99=%.6f" % (p99,))
+        return stats
+    def _query_fw_stats(self, eventtime):
+        # Run the background firmware statistics queries
+        stats = []
+        try:
+            for query in self._fw_stats_queries:
+                stats += query()
+        except self._printer.command_error as e:
+            # Don't report stale statistics (and only log the first error)
+            if not self._fw_stats_error:
+                logging.info("MCU '%s' statistics query failed: %s",
+                             self._name, str(e))
+            self._fw_stats_error = True
+            self._fw_stats = ""
+            self._fw_stats_pending = False
+            return
+        self._fw_stats_error = False
+        self._fw_stats = " ".join(stats)
+        self._fw_stats_pending = False
     def _handle_shutdown(self, params):
         if self._is_shutdown:
             return
@@ -801,6 +894,21 @@ class MCU:
         self.register_response(self._handle_shutdown, 'shutdown')
         self.register_response(self._handle_shutdown, 'is_shutdown')
         self.register_response(self._handle_mcu_stats, 'stats')
+        if self.try_lookup_command("sched_profile_get_task task=%c"):
+            self._profile_task_cmd = self.lookup_query_command(
+                "sched_profile_get_task task=%c",
+                "sched_profile_task task=%c count=%u sum=%u max=%u")
+            self._profile_timer_cmd = self.lookup_query_command(
+                "sched_profile_get_timer index=%c",
+                "sched_profile_timer index=%c func=%u count=%u sum=%u max=%u"
+                " max_latency=%u")
+            self._profile_timer_count = msgparser.get_constant_int(
+                'SCHED_PROFILE_TIMERS')
+            self._fw_stats_queries.append(self._query_profile)
+        if self.try_lookup_command("get_timer_jitter"):
+            self._jitter_cmd = self.lookup_query_command(
+                "get_timer_jitter", "timer_jitter max=%u counts=%*s")
+            self._fw_stats_queries.append(self._query_jitter)
     # Config creation helpers
     def setup_pin(self, pin_type, pin_params):
         pcs = {'endstop': MCU_endstop,
@@ -865,10 +973,14 @@ class MCU:
         return self._clocksync.print_time_to_clock(print_time)
     def clock_to_print_time(self, clock):
         return self._clocksync.clock_to_print_time(clock)
+    def get_print_time_translation(self):
+        return self._clocksync.get_print_time_translation()
     def estimated_print_time(self, eventtime):
         return self._clocksync.estimated_print_time(eventtime)
     def clock32_to_clock64(self, clock32):
         return self._clocksync.clock32_to_clock64(clock32)
+    def get_last_rtt(self):
+        return self._clocksync.get_last_rtt()
     # Restarts
     def _disconnect(self):
         self._serial.disconnect()
@@ -957,6 +1069,12 @@ class MCU:
             self._mcu_tick_awake, self._mcu_tick_avg, self._mcu_tick_stddev)
         stats = ' '.join([load, self._serial.stats(eventtime),
                           self._clocksync.stats(eventtime)])
+        if self._fw_stats_queries:
+            if self._fw_stats:
+                stats += ' ' + self._fw_stats
+            if not self._fw_stats_pending and not self._is_shutdown:
+                self._fw_stats_pending = True
+                self._reactor.register_callback(self._query_fw_stats)
         parts = [s.split('=', 1) for s in stats.split()]
         last_stats = {k:(float(v) if '.' in v else int(v)) for k, v in parts}
         self._get_status_info['last_stats'] = last_stats
@@ -41,6 +41,7 @@ class PT_uint32:
     is_dynamic_string = False
     max_length = 5
     signed = False
+    native_type = 'u'
     def encode(self, out, v):
         if v >= 0xc000000 or v < -0x4000000: out.append((v>>28) & 0x7f | 0x80)
         if v >= 0x180000 or v < -0x80000:    out.append((v>>21) & 0x7f | 0x80)
@@ -63,6 +64,7 @@ class PT_uint32:
 
 class PT_int32(PT_uint32):
     signed = True
+    native_type = 'i'
 class PT_uint16(PT_uint32):
     max_length = 3
 class PT_int16(PT_int32):
@@ -75,6 +77,7 @@ class PT_string:
     is_int = False
     is_dynamic_string = True
     max_length = 64
+    native_type = 's'
     def encode(self, out, v):
         out.append(len(v))
         out.extend(bytearray(v))
@@ -98,6 +101,7 @@ class enumeration_error(error):
 class Enumeration:
     is_int = False
     is_dynamic_string = False
+    native_type = 'o'
     def __init__(self, pt, enum_name, enums):
         self.pt = pt
         self.max_length = pt.max_length
@@ -170,7 +174,12 @@ class MessageFormat:
         self.param_names = lookup_params(msgformat, enumerations)
         self.param_types = [t for name, t in self.param_names]
         self.name_to_type = dict(self.param_names)
+        self.native_codec = None
     def encode(self, params):
+        if self.native_codec is not None:
+            out = self.native_codec.encode(self.msgid, params)
+            if out is not None:
+                return out
         out = []
         out.append(self.msgid)
         for i, t in enumerate(self.param_types):
@@ -198,6 +207,54 @@ class MessageFormat:
             out.append(v)
         return self.debugformat % tuple(out)
 
+# Wrapper around the C helper message encoder and decoder.  Calling
+# into the C code has a fixed overhead, so it is only used for
+# messages with enough parameters to benefit from it.
+NATIVE_ENCODE_MIN_PARAMS = 5
+NATIVE_DECODE_MIN_PARAMS = 3
+
+class NativeCodec:
+    def __init__(self, ffi_main, ffi_lib):
+        self.ffi_main, self.ffi_lib = ffi_main, ffi_lib
+        self.codec = ffi_main.gc(ffi_lib.msgcodec_alloc(),
+                                 ffi_lib.msgcodec_free)
+        # Encoding is done from the main thread and decoding from the
+        # serial background thread - each uses its own buffer
+        self.encode_buf = ffi_main.new('uint8_t[%d]' % (MESSAGE_MAX,))
+        self.decode_buf = ffi_main.new('int64_t[%d]' % (MESSAGE_MAX,))
+        self.formats = {}
+    def add_format(self, mp):
+        native_types = ''.join([t.native_type for t in mp.param_types])
+        ret = self.ffi_lib.msgcodec_add_format(self.codec, mp.msgid,
+                                               native_types.encode())
+        if ret:
+            return
+        names = [name for name, t in mp.param_names]
+        others = [(i, name, t) for i, (name, t) in enumerate(mp.param_names)
+                  if t.native_type in 'so']
+        if len(names) >= NATIVE_DECODE_MIN_PARAMS:
+            self.formats[mp.msgid] = (mp.name, names, others)
+        if not others and len(names) >= NATIVE_ENCODE_MIN_PARAMS:
+            mp.native_codec = self
+    def encode(self, msgid, params):
+        count = self.ffi_lib.msgcodec_encode(self.codec, msgid, params,
+                                             len(params), self.encode_buf)
+        if count < 0:
+            return None
+        return self.ffi_main.unpack(self.encode_buf, count)
+    def decode(self, s):
+        count = self.ffi_lib.msgcodec_decode(self.codec, s, len(s),
+                                             self.decode_buf, MESSAGE_MAX)
+        if count < 0:
+            return None
+        name, names, others = self.formats[s[MESSAGE_HEADER_SIZE]]
+        values = self.ffi_main.unpack(self.decode_buf, count)
+        params = dict(zip(names, values))
+        for i, pname, t in others:
+            params[pname] = t.parse(s, values[i])[0]
+        params['#name'] = name
+        return params
+
 class OutputFormat:
     name = '#output'
     def __init__(self, msgid, msgformat):
@@ -239,6 +296,7 @@ class MessageParser:
         self.config = {}
         self.version = self.build_versions = ""
         self.raw_identify_data = ""
+        self.native_codec = None
         self._init_messages(DefaultMessages)
     def _error(self, msg, *params):
         raise error(self.warn_prefix + (msg % params))
@@ -285,6 +343,11 @@ class MessageParser:
         return str(params)
     def parse(self, s):
         msgid = s[MESSAGE_HEADER_SIZE]
+        codec = self.native_codec
+        if codec is not None and msgid in codec.formats:
+            params = codec.decode(s)
+            if params is not None:
+                return params
         mid = self.messages_by_id.get(msgid, self.unknown)
         params, pos = mid.parse(s, MESSAGE_HEADER_SIZE)
         if pos != len(s)-MESSAGE_TRAILER_SIZE:
@@ -408,6 +471,13 @@ class MessageParser:
         except Exception as e:
             logging.exception("process_identify error")
             self._error("Error during identify: %s", str(e))
+    def init_native_codec(self, ffi_main, ffi_lib):
+        # Compile the message formats into the C helper codec
+        codec = NativeCodec(ffi_main, ffi_lib)
+        for mp in self.messages_by_id.values():
+            if isinstance(mp, MessageFormat):
+                codec.add_format(mp)
+        self.native_codec = codec
     def get_raw_data_dictionary(self):
         return self.raw_identify_data
     def get_version_info(self):
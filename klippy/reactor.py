@@ -3,7 +3,7 @@
 # Copyright (C) 2016-2020  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import os, gc, select, math, time, logging, queue
+import os, gc, select, math, time, logging, queue, heapq, bisect
 import greenlet
 import chelper, util
 
@@ -14,6 +14,32 @@ class ReactorTimer:
     def __init__(self, callback, waketime):
         self.callback = callback
         self.waketime = waketime
+        # Sequence number of the active heap entry (-1 if not scheduled,
+        # None if unregistered)
+        self.heap_seq = -1
+
+# Upper bounds (in seconds) of the timer profiling histogram buckets
+PROFILE_BUCKETS = [.000050, .000100, .000250, .000500, .001, .0025, .005,
+                   .010, .025, .050, .100]
+
+class ReactorTimerProfile:
+    def __init__(self, name):
+        self.name = name
+        self.count = 0
+        self.total_time = self.max_time = 0.
+        self.histogram = [0] * (len(PROFILE_BUCKETS) + 1)
+    def note_runtime(self, runtime):
+        self.count += 1
+        self.total_time += runtime
+        self.max_time = max(self.max_time, runtime)
+        self.histogram[bisect.bisect_left(PROFILE_BUCKETS, runtime)] += 1
+
+def get_callback_name(callback):
+    name = getattr(callback, '__name__', None) or repr(callback)
+    obj = getattr(callback, '__self__', None)
+    if obj is not None:
+        name = "%s.%s" % (type(obj).__name__, name)
+    return name
 
 class ReactorCompletion:
     class sentinel: pass
@@ -71,6 +97,8 @@ class ReactorMutex:
         self.unlock = self.__exit__
     def test(self):
         return self.is_locked
+    def has_waiters(self):
+        return not not self.queue
     def __enter__(self):
         if not self.is_locked:
             self.is_locked = True
@@ -102,7 +130,10 @@ class SelectReactor:
         self._last_gc_times = [0., 0., 0.]
         # Timers
         self._timers = []
+        self._timer_heap = []
+        self._timer_seq = 0
         self._next_timer = self.NEVER
+        self._timer_profiles = None
         # Callbacks
         self._pipe_fds = None
         self._async_queue = queue.Queue()
@@ -115,18 +146,39 @@ class SelectReactor:
     def get_gc_stats(self):
         return tuple(self._last_gc_times)
     # Timers
+    def _schedule_timer(self, timer_handler, waketime):
+        # Timers are stored in a heap ordered by waketime.  Updating a
+        # timer adds a new heap entry; old entries are discarded as
+        # stale (their sequence number no longer matches) when popped.
+        if waketime >= self.NEVER:
+            timer_handler.heap_seq = -1
+            return
+        seq = self._timer_seq
+        self._timer_seq = seq + 1
+        timer_handler.heap_seq = seq
+        heap = self._timer_heap
+        heapq.heappush(heap, (waketime, seq, timer_handler))
+        if len(heap) > 2 * len(self._timers) + 64:
+            # Remove stale entries
+            heap = [e for e in heap if e[1] == e[2].heap_seq]
+            heapq.heapify(heap)
+            self._timer_heap = heap
     def update_timer(self, timer_handler, waketime):
         timer_handler.waketime = waketime
+        if timer_handler.heap_seq is not None:
+            self._schedule_timer(timer_handler, waketime)
         self._next_timer = min(self._next_timer, waketime)
     def register_timer(self, callback, waketime=NEVER):
         timer_handler = ReactorTimer(callback, waketime)
         timers = list(self._timers)
         timers.append(timer_handler)
         self._timers = timers
+        self._schedule_timer(timer_handler, waketime)
         self._next_timer = min(self._next_timer, waketime)
         return timer_handler
     def unregister_timer(self, timer_handler):
         timer_handler.waketime = self.NEVER
+        timer_handler.heap_seq = None
         timers = list(self._timers)
         timers.pop(timers.index(timer_handler))
         self._timers = timers
@@ -149,17 +201,61 @@ class SelectReactor:
             return min(1., max(.001, self._next_timer - eventtime))
         self._next_timer = self.NEVER
         g_dispatch = self._g_dispatch
-        for t in self._timers:
-            waketime = t.waketime
-            if eventtime >= waketime:
-                t.waketime = self.NEVER
-                t.waketime = waketime = t.callback(eventtime)
-                if g_dispatch is not self._g_dispatch:
-                    self._next_timer = min(self._next_timer, waketime)
-                    self._end_greenlet(g_dispatch)
-                    return 0.
-            self._next_timer = min(self._next_timer, waketime)
+        heap = self._timer_heap
+        # Timers rescheduled during this pass are run on the next pass
+        end_seq = self._timer_seq
+        while heap:
+            waketime, seq, t = heap[0]
+            if eventtime < waketime or seq >= end_seq:
+                break
+            heapq.heappop(heap)
+            if seq != t.heap_seq:
+                # Stale entry
+                continue
+            t.heap_seq = -1
+            t.waketime = self.NEVER
+            if self._timer_profiles is not None:
+                waketime = self._profile_callback(t, eventtime)
+            else:
+                waketime = t.callback(eventtime)
+            t.waketime = waketime
+            if t.heap_seq is not None:
+                self._schedule_timer(t, waketime)
+            heap = self._timer_heap
+            if g_dispatch is not self._g_dispatch:
+                if heap:
+                    self._next_timer = min(self._next_timer, heap[0][0])
+                self._end_greenlet(g_dispatch)
+                return 0.
+        if heap:
+            self._next_timer = min(self._next_timer, heap[0][0])
         return 0.
+    # Timer profiling
+    def _profile_callback(self, t, eventtime):
+        g_dispatch = self._g_dispatch
+        start_time = self.monotonic()
+        waketime = t.callback(eventtime)
+        if g_dispatch is self._g_dispatch:
+            # Only track callbacks that did not pause
+            runtime = self.monotonic() - start_time
+            name = get_callback_name(t.callback)
+            profile = self._timer_profiles.get(name)
+            if profile is None:
+                profile = ReactorTimerProfile(name)
+                self._timer_profiles[name] = profile
+            profile.note_runtime(runtime)
+        return waketime
+    def set_timer_profiling(self, enable):
+        if enable:
+            if self._timer_profiles is None:
+                self._timer_profiles = {}
+        else:
+            self._timer_profiles = None
+    def get_timer_profiles(self):
+        if self._timer_profiles is None:
+            return []
+        return sorted(self._timer_profiles.values(),
+                      key=(lambda p: p.total_time), reverse=True)
     # Callbacks and Completions
     def completion(self):
         return ReactorCompletion(self)
@@ -3,7 +3,7 @@
 # Copyright (C) 2016-2021  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import logging, threading, os
+import logging, threading, os, struct, zlib
 import serial
 
 import msgproto, chelper, util
@@ -11,6 +11,8 @@ import msgproto, chelper, util
 class error(Exception):
     pass
 
+IDENTIFY_CHUNK = 40
+
 class SerialReader:
     BITS_PER_BYTE = 10.
     def __init__(self, reactor, warn_prefix=""):
@@ -34,6 +36,8 @@ class SerialReader:
         # Sent message notification tracking
         self.last_notify_id = 0
         self.pending_notifications = {}
+        # Data dictionary cache
+        self.dict_cache_dir = None
     def _bg_thread(self):
         response = self.ffi_main.new('struct pull_queue_message *')
         while 1:
@@ -60,23 +64,86 @@ class SerialReader:
                                   self.warn_prefix)
     def _error(self, msg, *params):
         raise error(self.warn_prefix + (msg % params))
+    def _get_identify_chunk(self, offset):
+        msg = "identify offset=%d count=%d" % (offset, IDENTIFY_CHUNK)
+        while 1:
+            params = self.send_with_response(msg, 'identify_response')
+            if params['offset'] == offset:
+                return params['data']
+    def _find_identify_end(self, first_chunk):
+        # Locate the last chunk of the data dictionary (chunk 0 is full)
+        lo, lo_data, hi, step = 0, first_chunk, None, 1
+        while hi is None or hi - lo > 1:
+            if hi is None:
+                idx = lo + step
+                step *= 2
+            else:
+                idx = (lo + hi) // 2
+            data = self._get_identify_chunk(idx * IDENTIFY_CHUNK)
+            if len(data) == IDENTIFY_CHUNK:
+                lo, lo_data = idx, data
+            elif data:
+                return idx * IDENTIFY_CHUNK + len(data), data
+            else:
+                hi = idx
+        return (lo + 1) * IDENTIFY_CHUNK, lo_data
+    def _get_cache_filename(self, size, tail):
+        # The dictionary is zlib compressed, so it ends with an adler32
+        # checksum of its contents
+        checksum = struct.unpack('>I', tail[-4:])[0]
+        return os.path.join(self.dict_cache_dir, "identify-%d-%08x.zlib"
+                            % (size, checksum))
+    def _load_cached_identify(self, first_chunk):
+        size, tail = self._find_identify_end(first_chunk)
+        if len(tail) < 4:
+            tail = self._get_identify_chunk(size - IDENTIFY_CHUNK)
+        filename = self._get_cache_filename(size, tail)
+        try:
+            with open(filename, 'rb') as f:
+                data = f.read()
+            zlib.decompress(data)
+        except (IOError, OSError, zlib.error) as e:
+            return None
+        if (len(data) != size or not data.startswith(first_chunk)
+            or not data.endswith(tail)):
+            return None
+        logging.info("%sUsing cached data dictionary %s",
+                     self.warn_prefix, filename)
+        return data
+    def _store_cached_identify(self, data):
+        filename = self._get_cache_filename(len(data), data)
+        try:
+            if not os.path.exists(self.dict_cache_dir):
+                os.makedirs(self.dict_cache_dir)
+            tmpname = "%s.%d.tmp" % (filename, os.getpid())
+            with open(tmpname, 'wb') as f:
+                f.write(data)
+            os.rename(tmpname, filename)
+        except (IOError, OSError) as e:
+            logging.warn("%sUnable to write data dictionary cache: %s",
+                         self.warn_prefix, e)
     def _get_identify_data(self, eventtime):
         # Query the "data dictionary" from the micro-controller
-        identify_data = b""
-        while 1:
-            msg = "identify offset=%d count=%d" % (len(identify_data), 40)
-            try:
-                params = self.send_with_response(msg, 'identify_response')
-            except error as e:
-                logging.exception("%sWait for identify_response",
-                                  self.warn_prefix)
-                return None
-            if params['offset'] == len(identify_data):
-                msgdata = params['data']
+        try:
+            identify_data = self._get_identify_chunk(0)
+            use_cache = (self.dict_cache_dir is not None
+                         and len(identify_data) == IDENTIFY_CHUNK)
+            if use_cache:
+                data = self._load_cached_identify(identify_data)
+                if data is not None:
+                    return data
+            while 1:
+                msgdata = self._get_identify_chunk(len(identify_data))
                 if not msgdata:
-                    # Done
-                    return identify_data
+                    break
                 identify_data += msgdata
+        except error as e:
+            logging.exception("%sWait for identify_response",
+                              self.warn_prefix)
+            return None
+        if use_cache:
+            self._store_cached_identify(identify_data)
+        return identify_data
     def _start_session(self, serial_dev, serial_fd_type=b'u', client_id=0):
         self.serial_dev = serial_dev
         self.serialqueue = self.ffi_main.gc(
@@ -94,6 +161,7 @@ class SerialReader:
             return False
         msgparser = msgproto.MessageParser(warn_prefix=self.warn_prefix)
         msgparser.process_identify(identify_data)
+        msgparser.init_native_codec(self.ffi_main, self.ffi_lib)
         self.msgparser = msgparser
         self.register_response(self.handle_unknown, '#unknown')
         # Setup baud adjust
@@ -194,9 +262,12 @@ class SerialReader:
             ret = self._start_session(serial_dev)
             if ret:
                 break
+    def set_dictionary_cache(self, cache_dir):
+        self.dict_cache_dir = cache_dir
     def connect_file(self, debugoutput, dictionary, pace=False):
         self.serial_dev = debugoutput
         self.msgparser.process_identify(dictionary, decompress=False)
+        self.msgparser.init_native_codec(self.ffi_main, self.ffi_lib)
         self.serialqueue = self.ffi_main.gc(
             self.ffi_lib.serialqueue_alloc(self.serial_dev.fileno(), b'f', 0),
             self.ffi_lib.serialqueue_free)
@@ -38,6 +38,7 @@ class MCU_stepper:
         self._dir_pin = dir_pin_params['pin']
         self._invert_dir = self._orig_invert_dir = dir_pin_params['invert']
         self._step_both_edge = self._req_step_both_edge = False
+        self._group_pins = []
         self._mcu_position_offset = 0.
         self._reset_cmd_tag = self._get_position_cmd = None
         self._active_callbacks = []
@@ -64,9 +65,22 @@ class MCU_stepper:
     def get_pulse_duration(self):
         return self._step_pulse_duration, self._step_both_edge
     def setup_default_pulse_duration(self, pulse_duration, step_both_edge):
+        if self._group_pins:
+            # Grouped steppers may use different drivers - use the defaults
+            return
         if self._step_pulse_duration is None:
             self._step_pulse_duration = pulse_duration
         self._req_step_both_edge = step_both_edge
+    def add_group_pins(self, step_pin_params, dir_pin_params):
+        for pin_params in (step_pin_params, dir_pin_params):
+            if pin_params['chip'] is not self._mcu:
+                raise self._mcu.get_printer().config_error(
+                    "Grouped stepper pins must be on same mcu as stepper '%s'"
+                    % (self._name,))
+        # Direction inversion is relative to this stepper's dir pin
+        invert_dir = dir_pin_params['invert'] ^ self._orig_invert_dir
+        self._group_pins.append((step_pin_params['pin'], dir_pin_params['pin'],
+                                 step_pin_params['invert'], invert_dir))
     def setup_itersolve(self, alloc_func, *params):
         ffi_main, ffi_lib = chelper.get_ffi()
         sk = ffi_main.gc(getattr(ffi_lib, alloc_func)(*params), ffi_lib.free)
@@ -87,6 +101,17 @@ class MCU_stepper:
             "config_stepper oid=%d step_pin=%s dir_pin=%s invert_step=%d"
             " step_pulse_ticks=%u" % (self._oid, self._step_pin, self._dir_pin,
                                       invert_step, step_pulse_ticks))
+        if self._group_pins and self._mcu.try_lookup_command(
+                "stepper_group_add_pins oid=%c step_pin=%c dir_pin=%c"
+                " invert_step=%c invert_dir=%c") is None:
+            raise self._mcu.get_printer().config_error(
+                "MCU '%s' does not support grouped steppers"
+                % (self._mcu.get_name(),))
+        for step_pin, dir_pin, g_invert_step, invert_dir in self._group_pins:
+            self._mcu.add_config_cmd(
+                "stepper_group_add_pins oid=%d step_pin=%s dir_pin=%s"
+                " invert_step=%d invert_dir=%d" % (
+                    self._oid, step_pin, dir_pin, g_invert_step, invert_dir))
         self._mcu.add_config_cmd("reset_step_clock oid=%d clock=0"
                                  % (self._oid,), on_restart=True)
         step_cmd_tag = self._mcu.lookup_command_tag(
@@ -252,6 +277,28 @@ def PrinterStepper(config, units_in_radians=False):
         m.register_stepper(config, mcu_stepper)
     return mcu_stepper
 
+# Helper code to step the pins of a config section along with an
+# existing stepper (using the existing stepper's mcu timer and queue)
+def PrinterGroupStepper(config, mcu_stepper, units_in_radians=False):
+    printer = config.get_printer()
+    ppins = printer.lookup_object('pins')
+    step_pin_params = ppins.lookup_pin(config.get('step_pin'), can_invert=True)
+    dir_pin_params = ppins.lookup_pin(config.get('dir_pin'), can_invert=True)
+    step_dist = parse_step_distance(config, units_in_radians, True)
+    if step_dist != mcu_stepper.get_rotation_distance():
+        raise config.error(
+            "Stepper '%s' must have the same step distance as '%s'"
+            " to use step_group" % (config.get_name(), mcu_stepper.get_name()))
+    for option in ['step_pulse_duration', 'endstop_pin']:
+        if config.get(option, None) is not None:
+            raise config.error("Option '%s' is not valid with step_group"
+                               " in section '%s'" % (option, config.get_name()))
+    mcu_stepper.add_group_pins(step_pin_params, dir_pin_params)
+    # Register with helper modules
+    for mname in ['stepper_enable', 'force_move']:
+        m = printer.load_object(config, mname)
+        m.register_stepper(config, mcu_stepper)
+
 # Parse stepper gear_ratio config parameter
 def parse_gear_ratio(config, note_valid):
     gear_ratio = config.getlists('gear_ratio', (), seps=(':', ','), count=2,
@@ -369,6 +416,11 @@ class PrinterRail:
     def get_endstops(self):
         return list(self.endstops)
     def add_extra_stepper(self, config):
+        if self.steppers and config.getboolean('step_group', False):
+            # Step along with the primary stepper
+            PrinterGroupStepper(config, self.steppers[0],
+                                self.stepper_units_in_radians)
+            return
         stepper = PrinterStepper(config, self.stepper_units_in_radians)
         self.steppers.append(stepper)
         if self.endstops and config.get('endstop_pin', None) is None:
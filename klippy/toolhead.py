@@ -194,6 +194,72 @@ DRIP_TIME = 0.100
 class DripModeEndSignal(Exception):
     pass
 
+# Track a decaying peak of a measured latency
+class LatencyPeak:
+    def __init__(self, half_life):
+        self.decay_rate = math.log(2.) / half_life
+        self.peak = self.peak_time = 0.
+    def note(self, value, eventtime):
+        if value >= self.get(eventtime):
+            self.peak, self.peak_time = value, eventtime
+    def get(self, eventtime):
+        age = max(0., eventtime - self.peak_time)
+        return self.peak * math.exp(-age * self.decay_rate)
+
+# Adaptive tuning of buffer_time_low/buffer_time_high from measured
+# host scheduling latency, step generation time, and mcu round-trip-time
+LATENCY_HALF_LIFE = 300.
+LATENCY_MARGIN = 4.
+PROBE_TIME = 0.250
+
+class BufferTimeTuning:
+    def __init__(self, toolhead, config):
+        self.toolhead = toolhead
+        self.reactor = toolhead.reactor
+        self.min_low = config.getfloat('buffer_time_min', 0.250, above=0.)
+        self.max_low = config.getfloat('buffer_time_max', 2.000,
+                                       above=self.min_low)
+        self.high_ratio = toolhead.buffer_time_high / toolhead.buffer_time_low
+        self.reactor_latency = LatencyPeak(LATENCY_HALF_LIFE)
+        self.stepgen_time = LatencyPeak(LATENCY_HALF_LIFE)
+        self.mcu_rtt = LatencyPeak(LATENCY_HALF_LIFE)
+        self.probe_waketime = 0.
+        self.probe_timer = self.reactor.register_timer(self._probe_event)
+        toolhead.printer.register_event_handler("klippy:ready",
+                                                self._handle_ready)
+    def _handle_ready(self):
+        if not self.toolhead.can_pause:
+            return
+        self.probe_waketime = self.reactor.monotonic() + PROBE_TIME
+        self.reactor.update_timer(self.probe_timer, self.probe_waketime)
+    def _probe_event(self, eventtime):
+        # Measure how late the reactor ran this timer
+        curtime = self.reactor.monotonic()
+        self.reactor_latency.note(curtime - self.probe_waketime, curtime)
+        self.update(curtime)
+        self.probe_waketime = curtime + PROBE_TIME
+        return self.probe_waketime
+    def note_stepgen_time(self, gen_time, eventtime):
+        self.stepgen_time.note(gen_time, eventtime)
+    def _get_latency(self, eventtime):
+        return (self.reactor_latency.get(eventtime)
+                + self.stepgen_time.get(eventtime)
+                + self.mcu_rtt.get(eventtime))
+    def update(self, eventtime):
+        toolhead = self.toolhead
+        for m in toolhead.all_mcus:
+            self.mcu_rtt.note(m.get_last_rtt(), eventtime)
+        low = LATENCY_MARGIN * self._get_latency(eventtime)
+        low = min(max(low, self.min_low), self.max_low)
+        toolhead.buffer_time_low = low
+        toolhead.buffer_time_high = low * self.high_ratio
+    def get_status(self, eventtime):
+        return {
+            'reactor_latency': self.reactor_latency.get(eventtime),
+            'stepgen_time': self.stepgen_time.get(eventtime),
+            'mcu_rtt': self.mcu_rtt.get(eventtime),
+            'latency': self._get_latency(eventtime) }
+
 # Main code to track events (and their timing) on the printer toolhead
 class ToolHead:
     def __init__(self, config):
@@ -228,6 +294,9 @@ class ToolHead:
             'buffer_time_start', 0.250, above=0.)
         self.move_flush_time = config.getfloat(
             'move_flush_time', 0.050, above=0.)
+        self.buffer_tuning = None
+        if config.getboolean('buffer_time_adaptive', False):
+            self.buffer_tuning = BufferTimeTuning(self, config)
         self.print_time = 0.
         self.special_queuing_state = "Flushed"
         self.need_check_stall = -1.
@@ -279,7 +348,10 @@ class ToolHead:
         batch_time = MOVE_BATCH_TIME
         kin_flush_delay = self.kin_flush_delay
         lkft = self.last_kin_flush_time
+        buffer_tuning = self.buffer_tuning
         while 1:
+            if buffer_tuning is not None:
+                gen_start = self.reactor.monotonic()
             self.print_time = min(self.print_time + batch_time, next_print_time)
             sg_flush_time = max(lkft, self.print_time - kin_flush_delay)
             for sg in self.step_generators:
@@ -290,6 +362,9 @@ class ToolHead:
             mcu_flush_time = max(lkft, sg_flush_time - self.move_flush_time)
             for m in self.all_mcus:
                 m.flush_moves(mcu_flush_time)
+            if buffer_tuning is not None:
+                gen_end = self.reactor.monotonic()
+                buffer_tuning.note_stepgen_time(gen_end - gen_start, gen_end)
             if self.print_time >= next_print_time:
                 break
     def _calc_print_time(self):
@@ -508,7 +583,11 @@ class ToolHead:
                      'max_velocity': self.max_velocity,
                      'max_accel': self.max_accel,
                      'max_accel_to_decel': self.requested_accel_to_decel,
-                     'square_corner_velocity': self.square_corner_velocity})
+                     'square_corner_velocity': self.square_corner_velocity,
+                     'buffer_time_low': self.buffer_time_low,
+                     'buffer_time_high': self.buffer_time_high})
+        if self.buffer_tuning is not None:
+            res['buffer_tuning'] = self.buffer_tuning.get_status(eventtime)
         return res
     def _handle_shutdown(self):
         self.can_pause = False
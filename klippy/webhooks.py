@@ -257,7 +257,10 @@ class ClientConnection:
         self.send(result)
 
     def send(self, data):
-        jmsg = json.dumps(data, separators=(',', ':'))
+        self.send_encoded(json.dumps(data, separators=(',', ':')))
+
+    def send_encoded(self, jmsg):
+        # Send an already json encoded message
         self.send_buffer += jmsg.encode() + b"\x03"
         if not self.is_sending_data:
             self.is_sending_data = True
@@ -434,6 +437,7 @@ class GCodeHelper:
             self.is_output_registered = True
 
 SUBSCRIPTION_REFRESH_TIME = .25
+json_encode = json.JSONEncoder(separators=(',', ':')).encode
 
 class QueryStatusHelper:
     def __init__(self, printer):
@@ -441,7 +445,10 @@ class QueryStatusHelper:
         self.clients = {}
         self.pending_queries = []
         self.query_timer = None
-        self.last_query = {}
+        self.query = self.last_query = {}
+        self.changes = {}
+        self.encoded = {}
+        self.fragments = {}
         # Register webhooks
         webhooks = printer.lookup_object('webhooks')
         webhooks.register_endpoint("objects/list", self._handle_list)
@@ -451,46 +458,100 @@ class QueryStatusHelper:
         objects = [n for n, o in self.printer.lookup_objects()
                    if hasattr(o, 'get_status')]
         web_request.send({'objects': objects})
+    def _get_status(self, obj_name, eventtime):
+        res = self.query.get(obj_name, None)
+        if res is None:
+            po = self.printer.lookup_object(obj_name, None)
+            if po is None or not hasattr(po, 'get_status'):
+                res = self.query[obj_name] = {}
+            else:
+                res = self.query[obj_name] = po.get_status(eventtime)
+        return res
+    def _get_req_items(self, subscription, obj_name, eventtime):
+        res = self._get_status(obj_name, eventtime)
+        req_items = subscription[obj_name]
+        if req_items is None:
+            req_items = tuple(res.keys())
+            if req_items:
+                subscription[obj_name] = req_items
+        return res, req_items
+    def _get_changes(self, obj_name, eventtime):
+        # Find the fields of an object that changed since the last
+        # query - done once per object for all clients
+        res = self._get_status(obj_name, eventtime)
+        lres = self.last_query.get(obj_name, {})
+        changes = self.changes[obj_name] = {}
+        for ri, rd in res.items():
+            if rd != lres.get(ri):
+                changes[ri] = rd
+        for ri, rd in lres.items():
+            if ri not in res and rd is not None:
+                changes[ri] = None
+        return changes
+    def _encode_field(self, obj_name, ri, rd):
+        # Json encode a changed field (once, and only if requested)
+        key = (obj_name, ri)
+        enc = self.encoded.get(key, None)
+        if enc is None:
+            enc = self.encoded[key] = '%s:%s' % (json_encode(ri),
+                                                 json_encode(rd))
+        return enc
+    def _encode_changes(self, obj_name, req_items, changes):
+        # Build the encoded status fragment of an object for a set of
+        # requested fields (shared by clients with the same request)
+        key = (obj_name, req_items)
+        frag = self.fragments.get(key, None)
+        if frag is None:
+            items = [self._encode_field(obj_name, ri, changes[ri])
+                     for ri in req_items if ri in changes]
+            frag = ''
+            if items:
+                frag = '%s:{%s}' % (json_encode(obj_name), ','.join(items))
+            self.fragments[key] = frag
+        return frag
     def _do_query(self, eventtime):
-        last_query = self.last_query
-        query = self.last_query = {}
+        self.last_query = self.query
+        self.query = {}
+        self.changes = {}
+        self.encoded = {}
+        self.fragments = {}
         msglist = self.pending_queries
         self.pending_queries = []
-        msglist.extend(self.clients.values())
-        # Generate get_status() info for each client
-        for cconn, subscription, send_func, template in msglist:
-            is_query = cconn is None
-            if not is_query and cconn.is_closed():
+        # Respond to one-time queries with the full requested status
+        for subscription, send_func, template in msglist:
+            cquery = {}
+            for obj_name in list(subscription.keys()):
+                res, req_items = self._get_req_items(subscription, obj_name,
+                                                     eventtime)
+                cquery[obj_name] = {ri: res.get(ri, None)
+                                    for ri in req_items}
+            tmp = dict(template)
+            tmp['params'] = {'eventtime': eventtime, 'status': cquery}
+            send_func(tmp)
+        # Send changed fields to subscribed clients
+        enc_eventtime = json_encode(eventtime)
+        for cconn, subscription, prefix in list(self.clients.values()):
+            if cconn.is_closed():
                 del self.clients[cconn]
                 continue
-            # Query each requested printer object
-            cquery = {}
+            frags = []
             for obj_name, req_items in subscription.items():
-                res = query.get(obj_name, None)
-                if res is None:
-                    po = self.printer.lookup_object(obj_name, None)
-                    if po is None or not hasattr(po, 'get_status'):
-                        res = query[obj_name] = {}
-                    else:
-                        res = query[obj_name] = po.get_status(eventtime)
                 if req_items is None:
-                    req_items = list(res.keys())
-                    if req_items:
-                        subscription[obj_name] = req_items
-                lres = last_query.get(obj_name, {})
-                cres = {}
-                for ri in req_items:
-                    rd = res.get(ri, None)
-                    if is_query or rd != lres.get(ri):
-                        cres[ri] = rd
-                if cres or is_query:
-                    cquery[obj_name] = cres
-            # Send data
-            if cquery or is_query:
-                tmp = dict(template)
-                tmp['params'] = {'eventtime': eventtime, 'status': cquery}
-                send_func(tmp)
-        if not query:
+                    res, req_items = self._get_req_items(
+                        subscription, obj_name, eventtime)
+                changes = self.changes.get(obj_name, None)
+                if changes is None:
+                    changes = self._get_changes(obj_name, eventtime)
+                if not changes:
+                    # Nothing changed - skip object for all clients
+                    continue
+                frag = self._encode_changes(obj_name, req_items, changes)
+                if frag:
+                    frags.append(frag)
+            if frags:
+                cconn.send_encoded('%s%s,"status":{%s}}}' % (
+                    prefix, enc_eventtime, ','.join(frags)))
+        if not self.query:
             # Unregister timer if there are no longer any subscriptions
             reactor = self.printer.get_reactor()
             reactor.unregister_timer(self.query_timer)
@@ -507,6 +568,8 @@ class QueryStatusHelper:
                 for ri in v:
                     if type(ri) != str:
                         raise web_request.error("Invalid argument")
+        objects = {k: v if v is None else tuple(v)
+                   for k, v in objects.items()}
         # Add to pending queries
         cconn = web_request.get_client_connection()
         template = web_request.get_dict('response_template', {})
@@ -514,7 +577,7 @@ class QueryStatusHelper:
             del self.clients[cconn]
         reactor = self.printer.get_reactor()
         complete = reactor.completion()
-        self.pending_queries.append((None, objects, complete.complete, {}))
+        self.pending_queries.append((objects, complete.complete, {}))
         # Start timer if needed
         if self.query_timer is None:
             qt = reactor.register_timer(self._do_query, reactor.NOW)
@@ -523,7 +586,14 @@ class QueryStatusHelper:
         msg = complete.wait()
         web_request.send(msg['params'])
         if is_subscribe:
-            self.clients[cconn] = (cconn, objects, cconn.send, template)
+            # Encode the response template once for all status updates
+            tmp = dict(template)
+            tmp.pop('params', None)
+            prefix = json.dumps(tmp, separators=(',', ':'))[:-1]
+            if tmp:
+                prefix += ','
+            prefix += '"params":{"eventtime":'
+            self.clients[cconn] = (cconn, objects, prefix)
     def _handle_subscribe(self, web_request):
         self._handle_query(web_request, is_subscribe=True)
 
@@ -17,6 +17,7 @@ FILEHEADER = """
 #include "command.h"
 #include "compiler.h"
 #include "initial_pins.h"
+#include "sched.h"
 """
 
 def error(msg):
@@ -34,17 +35,33 @@ Handlers = []
 class HandleCallList:
     def __init__(self):
         self.call_lists = {'ctr_run_initfuncs': []}
-        self.ctr_dispatch = { '_DECL_CALLLIST': self.decl_calllist }
+        self.profile_lists = {}
+        self.ctr_dispatch = {
+            '_DECL_CALLLIST': self.decl_calllist,
+            '_DECL_CALLLIST_PROFILE': self.decl_calllist_profile,
+        }
     def decl_calllist(self, req):
         funcname, callname = req.split()[1:]
         self.call_lists.setdefault(funcname, []).append(callname)
+    def decl_calllist_profile(self, req):
+        funcname, wrapname, enumname = req.split()[1:]
+        self.profile_lists[funcname] = (wrapname, enumname)
     def update_data_dictionary(self, data):
-        pass
+        for funcname, (wrapname, enumname) in self.profile_lists.items():
+            for i, f in enumerate(self.call_lists.get(funcname, [])):
+                HandlerEnumerations.add_enumeration(enumname, f, i)
     def generate_code(self, options):
         code = []
         for funcname, funcs in self.call_lists.items():
             func_code = ['    extern void %s(void);\n    %s();' % (f, f)
                          for f in funcs]
+            profile = self.profile_lists.get(funcname)
+            if profile is not None:
+                # Invoke each function via a profiling wrapper
+                func_code = [
+                    '    extern void %s(void);\n    %s(&%s_profile[%d], %s);'
+                    % (f, profile[0], funcname, i, f)
+                    for i, f in enumerate(funcs)]
             if funcname == 'ctr_run_taskfuncs':
                 add_poll = '    irq_poll();\n'
                 func_code = [add_poll + fc for fc in func_code]
@@ -56,6 +73,18 @@ void
     %s
 }
 """
+            if profile is not None:
+                fmt = """
+static struct sched_profile_stat %s_profile[%d];
+
+struct sched_profile_stat *
+%s_profile_lookup(uint_fast8_t id)
+{
+    if (id >= ARRAY_SIZE(%s_profile))
+        return NULL;
+    return &%s_profile[id];
+}
+""" % ((funcname, max(len(funcs), 1)) + (funcname,) * 3) + fmt
             code.append(fmt % (funcname, "\n".join(func_code).strip()))
         return "".join(code)
 
@@ -247,6 +276,9 @@ Handlers.append(Handle_arm_irq())
 ######################################################################
 
 # Dynamic command and response registration
+INT_PARAM_TYPES = ('PT_uint32', 'PT_int32', 'PT_uint16', 'PT_int16',
+                   'PT_byte')
+
 class HandleCommandGeneration:
     def __init__(self):
         self.commands = {}
@@ -254,6 +286,7 @@ class HandleCommandGeneration:
         self.msg_to_id = dict(msgproto.DefaultMessages)
         self.messages_by_name = { m.split()[0]: m for m in self.msg_to_id }
         self.all_param_types = {}
+        self.int_parsers = {}
         self.ctr_dispatch = {
             'DECL_COMMAND_FLAGS': self.decl_command,
             '_DECL_ENCODER': self.decl_encoder,
@@ -335,6 +368,11 @@ class HandleCommandGeneration:
             num_args = (len(types) + types.count('PT_progmem_buffer')
                         + types.count('PT_buffer'))
             out += "    .num_args=%d," % (num_args,)
+            # Commands with only integer parameters use a specialized
+            # parser (all integer types share the same encoding)
+            if types and not [t for t in types if t not in INT_PARAM_TYPES]:
+                self.int_parsers[len(types)] = True
+                out += "\n    .parse=command_parse_ints%d," % (len(types),)
         else:
             max_size = min(msgproto.MESSAGE_MAX,
                            (msgproto.MESSAGE_MIN + 1
@@ -425,12 +463,26 @@ const uint8_t command_index_size PROGMEM = ARRAY_SIZE(command_index);
                     paramid, ', '.join(argtypes),))
         params.append('')
         return "\n".join(params)
+    def generate_int_parsers_code(self):
+        parsers = []
+        for count in sorted(self.int_parsers):
+            code = ["    if (p > maxend)\n"
+                    "        command_parse_error();\n"
+                    "    args[%d] = command_parse_int(&p);\n" % (i,)
+                    for i in range(count)]
+            parsers.append(
+                "static uint8_t *\n"
+                "command_parse_ints%d(uint8_t *p, uint8_t *maxend"
+                ", uint32_t *args)\n{\n%s    return p;\n}\n" % (
+                    count, "".join(code)))
+        return "\n" + "\n".join(parsers)
     def generate_code(self, options):
         self.create_message_ids()
         parsercode = self.generate_responses_code()
         cmdcode = self.generate_commands_code()
         paramcode = self.generate_param_code()
-        return paramcode + parsercode + cmdcode
+        intcode = self.generate_int_parsers_code()
+        return paramcode + intcode + parsercode + cmdcode
 
 Handlers.append(HandleCommandGeneration())
 
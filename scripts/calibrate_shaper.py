@@ -12,10 +12,15 @@ import numpy as np, matplotlib
 sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
                              '..', 'klippy'))
 shaper_calibrate = importlib.import_module('.shaper_calibrate', 'extras')
+accel_capture = importlib.import_module('.accel_capture', 'extras')
 
 MAX_TITLE_LENGTH=65
 
 def parse_log(logname):
+    if accel_capture.is_capture_file(logname):
+        # Binary raw accelerometer capture
+        columns, metadata = accel_capture.read_capture(logname, np)
+        return columns
     with open(logname) as f:
         for header in f:
             if not header.startswith('#'):
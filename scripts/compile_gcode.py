@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# Convert a gcode file to the compiled format read by virtual_sdcard
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import importlib, optparse, os, sys
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', 'klippy'))
+import chelper
+virtual_sdcard = importlib.import_module('.virtual_sdcard', 'extras')
+
+MAX_TEXT_LENGTH = 0xffff
+
+def compile_gcode(infile, outfile):
+    ffi_main, ffi_lib = chelper.get_ffi()
+    gparams = ffi_main.new('struct gcode_params *')
+    move_mask = 1 << (ord('G') - ord('A'))
+    for p in virtual_sdcard.BINARY_PARAMS:
+        move_mask |= 1 << (ord(p) - ord('A'))
+    f_bit = 1 << (ord('F') - ord('A'))
+    counts = [0, 0]
+    outfile.write(virtual_sdcard.BINARY_HEADER)
+    for line in infile:
+        line = line.rstrip('\r\n')
+        sline = line.strip()
+        if not sline or sline.startswith(';'):
+            # Comments and blank lines have no effect on a print
+            continue
+        gnum = ffi_lib.gcode_parse_move(gparams, sline.encode())
+        mask = gparams.mask
+        if (gnum in (0, 1) and not mask & ~move_mask
+            and (not mask & f_bit or gparams.values[ord('F')-ord('A')] > 0.)):
+            params = {}
+            for p in virtual_sdcard.BINARY_PARAMS:
+                i = ord(p) - ord('A')
+                if mask & (1 << i):
+                    params[p] = gparams.values[i]
+            outfile.write(virtual_sdcard.encode_move_record(gnum, params))
+            counts[0] += 1
+            continue
+        if len(line.encode()) > MAX_TEXT_LENGTH:
+            raise ValueError("Line too long: %s..." % (line[:40],))
+        outfile.write(virtual_sdcard.encode_text_record(line))
+        counts[1] += 1
+    return counts
+
+def main():
+    usage = "%prog [options] <input.gcode> <output.kgc>"
+    opts = optparse.OptionParser(usage)
+    options, args = opts.parse_args()
+    if len(args) != 2:
+        opts.error("Incorrect number of arguments")
+    with open(args[0], 'r') as infile:
+        with open(args[1], 'wb') as outfile:
+            moves, texts = compile_gcode(infile, outfile)
+    print("Wrote %d move records and %d text records" % (moves, texts))
+
+if __name__ == '__main__':
+    main()
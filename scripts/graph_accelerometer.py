@@ -11,17 +11,23 @@ import numpy as np, matplotlib
 sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
                              '..', 'klippy'))
 shaper_calibrate = importlib.import_module('.shaper_calibrate', 'extras')
+accel_capture = importlib.import_module('.accel_capture', 'extras')
 
 MAX_TITLE_LENGTH=65
 
 def parse_log(logname, opts):
+    if accel_capture.is_capture_file(logname):
+        # Binary raw accelerometer capture
+        columns, metadata = accel_capture.read_capture(logname, np)
+        return columns
     with open(logname) as f:
         for header in f:
             if not header.startswith('#'):
                 break
         if not header.startswith('freq,psd_x,psd_y,psd_z,psd_xyz'):
             # Raw accelerometer data
-            return np.loadtxt(logname, comments='#', delimiter=',')
+            data = np.loadtxt(logname, comments='#', delimiter=',')
+            return tuple(data.T)
     # Power spectral density data or shaper calibration data
     opts.error("File %s does not contain raw accelerometer data and therefore "
                "is not supported by graph_accelerometer.py script. Please use "
@@ -32,15 +38,15 @@ def parse_log(logname, opts):
 ######################################################################
 
 def plot_accel(data, logname):
-    first_time = data[0, 0]
-    times = data[:,0] - first_time
+    first_time = data[0][0]
+    times = data[0] - first_time
     fig, axes = matplotlib.pyplot.subplots(nrows=3, sharex=True)
     axes[0].set_title("\n".join(wrap("Accelerometer data (%s)" % (logname,),
                                      MAX_TITLE_LENGTH)))
     axis_names = ['x', 'y', 'z']
     for i in range(len(axis_names)):
-        avg = data[:,i+1].mean()
-        adata = data[:,i+1] - data[:,i+1].mean()
+        avg = data[i+1].mean()
+        adata = data[i+1] - avg
         ax = axes[i]
         ax.plot(times, adata, alpha=0.8)
         ax.grid(True)
@@ -60,8 +66,8 @@ def calc_freq_response(data, max_freq):
     return helper.process_accelerometer_data(data)
 
 def calc_specgram(data, axis):
-    N = data.shape[0]
-    Fs = N / (data[-1,0] - data[0,0])
+    N = data[0].shape[0]
+    Fs = N / (data[0][-1] - data[0][0])
     # Round up to a power of 2 for faster FFT
     M = 1 << int(.5 * Fs - 1).bit_length()
     window = np.kaiser(M, 6.)
@@ -70,7 +76,7 @@ def calc_specgram(data, axis):
                 x, Fs=Fs, NFFT=M, noverlap=M//2, window=window,
                 mode='psd', detrend='mean', scale_by_freq=False)
 
-    d = {'x': data[:,1], 'y': data[:,2], 'z': data[:,3]}
+    d = {'x': data[1], 'y': data[2], 'z': data[3]}
     if axis != 'all':
         pdata, bins, t = _specgram(d[axis])
     else:
@@ -54,8 +54,8 @@ f4: *p++ = v & 0x7f;
 }
 
 // Parse an integer that was encoded as a "variable length quantity"
-static uint32_t
-parse_int(uint8_t **pp)
+uint32_t
+command_parse_int(uint8_t **pp)
 {
     uint8_t *p = *pp, c = *p++;
     uint32_t v = c & 0x7f;
@@ -87,7 +87,7 @@ command_parsef(uint8_t *p, uint8_t *maxend
         case PT_uint16:
         case PT_int16:
         case PT_byte:
-            *args++ = parse_int(&p);
+            *args++ = command_parse_int(&p);
             break;
         case PT_buffer: {
             uint_fast8_t len = *p++;
@@ -104,6 +104,13 @@ command_parsef(uint8_t *p, uint8_t *maxend
     }
     return p;
 error:
+    command_parse_error();
+}
+
+// Report a malformed command (also used by the generated parsers)
+void
+command_parse_error(void)
+{
     shutdown("Command parser error");
 }
 
@@ -312,7 +319,11 @@ command_dispatch(uint8_t *buf, uint_fast8_t msglen)
         uint_fast8_t cmdid = *p++;
         const struct command_parser *cp = command_lookup_parser(cmdid);
         uint32_t args[READP(cp->num_args)];
-        p = command_parsef(p, msgend, cp, args);
+        uint8_t *(*parse)(uint8_t*, uint8_t*, uint32_t*) = READP(cp->parse);
+        if (parse)
+            p = parse(p, msgend, args);
+        else
+            p = command_parsef(p, msgend, cp, args);
         if (sched_is_shutdown() && !(READP(cp->flags) & HF_IN_SHUTDOWN)) {
             sched_report_shutdown();
             continue;
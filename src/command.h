@@ -63,6 +63,7 @@ struct command_encoder {
 struct command_parser {
     uint8_t msg_id, num_args, flags, num_params;
     const uint8_t *param_types;
+    uint8_t *(*parse)(uint8_t *p, uint8_t *maxend, uint32_t *args);
     void (*func)(uint32_t *args);
 };
 enum {
@@ -72,6 +73,8 @@ enum {
 
 // command.c
 void *command_decode_ptr(uint32_t v);
+uint32_t command_parse_int(uint8_t **pp);
+void command_parse_error(void) __noreturn;
 uint8_t *command_parsef(uint8_t *p, uint8_t *maxend
                         , const struct command_parser *cp, uint32_t *args);
 uint_fast8_t command_encode_and_frame(
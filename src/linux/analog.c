@@ -4,10 +4,14 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include <dirent.h> // opendir
+#include <errno.h> // errno
 #include <fcntl.h> // open
 #include <stdio.h> // snprintf
 #include <stdlib.h> // atoi
+#include <string.h> // strcmp
 #include <unistd.h> // read
+#include "board/misc.h" // timer_read_time
 #include "command.h" // shutdown
 #include "gpio.h" // gpio_adc_setup
 #include "internal.h" // report_errno
@@ -21,9 +25,276 @@ DECL_ENUMERATION_RANGE("pin", "analog0", ANALOG_START, 8);
 
 #define IIO_PATH "/sys/bus/iio/devices/iio:device0/in_voltage%d_raw"
 
+
+
+/****************************************************************
+ * Buffered (character device) capture
+ ****************************************************************/
+
+// Buffered mode reads whole blocks of scans from the IIO character
+// device (filled by a kernel trigger) instead of reading one sysfs
+// file per sample.  The most recent scans of each channel are queued
+// and handed out newest first, so one read of the device can serve
+// all the oversamples of a query.
+
+#define IIO_MAX_CHANNELS 8
+#define IIO_QUEUE_SIZE 16
+#define IIO_BUFFER_LENGTH 1024
+#define IIO_READ_SIZE 1024
+
+struct iio_channel {
+    uint8_t chan, index, offset, bytes, shift, bits, is_be, is_signed;
+    uint8_t head, count;
+    uint16_t last, queue[IIO_QUEUE_SIZE];
+};
+
+static struct {
+    int fd;
+    uint8_t channel_count, scan_size;
+    uint32_t drain_time;
+    struct iio_channel channels[IIO_MAX_CHANNELS];
+} IIOBuffer = { .fd = -1 };
+
+// Write a string to a file in the IIO device sysfs directory
+static int
+iio_sysfs_write(const char *name, const char *val)
+{
+    char fname[256];
+    snprintf(fname, sizeof(fname), "%s/%s", CONFIG_LINUX_IIO_SYSFS_DIR, name);
+    int fd = open(fname, O_WRONLY|O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int ret = write(fd, val, strlen(val));
+    close(fd);
+    return ret < 0 ? -1 : 0;
+}
+
+// Read a (short) string from a file in the IIO device sysfs directory
+static int
+iio_sysfs_read(const char *name, char *buf, int size)
+{
+    char fname[256];
+    snprintf(fname, sizeof(fname), "%s/%s", CONFIG_LINUX_IIO_SYSFS_DIR, name);
+    int fd = open(fname, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    int ret = read(fd, buf, size - 1);
+    close(fd);
+    if (ret < 0)
+        return -1;
+    buf[ret] = '\0';
+    return 0;
+}
+
+// Stop the buffer so that its scan elements may be changed
+static void
+iio_buffer_stop(void)
+{
+    if (IIOBuffer.fd < 0)
+        return;
+    close(IIOBuffer.fd);
+    IIOBuffer.fd = -1;
+    iio_sysfs_write("buffer/enable", "0");
+}
+
+// Stop a buffer left running and disable all scan elements (they
+// may have been left enabled by a previous user of the device)
+static void
+iio_buffer_reset(void)
+{
+    iio_sysfs_write("buffer/enable", "0");
+    char name[256];
+    snprintf(name, sizeof(name), "%s/scan_elements"
+             , CONFIG_LINUX_IIO_SYSFS_DIR);
+    DIR *dir = opendir(name);
+    if (!dir) {
+        report_errno("iio scan_elements", -1);
+        shutdown("Unable to open iio scan_elements directory");
+    }
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        int len = strlen(de->d_name);
+        if (len < 3 || strcmp(&de->d_name[len - 3], "_en") != 0)
+            continue;
+        snprintf(name, sizeof(name), "scan_elements/%s", de->d_name);
+        if (iio_sysfs_write(name, "0") < 0) {
+            report_errno("iio scan disable", -1);
+            closedir(dir);
+            shutdown("Unable to disable iio scan element");
+        }
+    }
+    closedir(dir);
+}
+
+// Enable a channel in the buffer scans and determine its data format
+static uint8_t
+iio_buffer_add_channel(uint8_t chan)
+{
+    int i;
+    for (i=0; i<IIOBuffer.channel_count; i++)
+        if (IIOBuffer.channels[i].chan == chan)
+            return i;
+    if (IIOBuffer.channel_count >= ARRAY_SIZE(IIOBuffer.channels))
+        shutdown("Too many iio buffer channels");
+    if (!IIOBuffer.channel_count)
+        iio_buffer_reset();
+    else
+        iio_buffer_stop();
+
+    char name[64], buf[64], endian[4], sign;
+    unsigned int bits, storage, shift = 0;
+    snprintf(name, sizeof(name), "scan_elements/in_voltage%d_en", chan);
+    if (iio_sysfs_write(name, "1") < 0) {
+        report_errno("iio scan enable", -1);
+        shutdown("Unable to enable iio buffer channel");
+    }
+    snprintf(name, sizeof(name), "scan_elements/in_voltage%d_index", chan);
+    if (iio_sysfs_read(name, buf, sizeof(buf)) < 0)
+        shutdown("Unable to read iio buffer channel index");
+    uint8_t index = atoi(buf);
+    snprintf(name, sizeof(name), "scan_elements/in_voltage%d_type", chan);
+    if (iio_sysfs_read(name, buf, sizeof(buf)) < 0
+        || sscanf(buf, "%2[bl]e:%c%u/%u>>%u", endian, &sign, &bits, &storage
+                  , &shift) < 4
+        || (storage != 8 && storage != 16 && storage != 32) || bits > 16)
+        shutdown("Unsupported iio buffer channel type");
+
+    struct iio_channel *c = &IIOBuffer.channels[IIOBuffer.channel_count];
+    c->chan = chan;
+    c->index = index;
+    c->bytes = storage / 8;
+    c->shift = shift;
+    c->bits = bits;
+    c->is_be = endian[0] == 'b';
+    c->is_signed = sign == 's';
+    return IIOBuffer.channel_count++;
+}
+
+// Determine the scan layout and start the buffer
+static void
+iio_buffer_start(void)
+{
+    // Channels are stored in scan index order, each naturally aligned
+    uint_fast8_t offset = 0, max_bytes = 1, i, j;
+    int last_index = -1;
+    for (i=0; i<IIOBuffer.channel_count; i++) {
+        struct iio_channel *next = NULL;
+        for (j=0; j<IIOBuffer.channel_count; j++) {
+            struct iio_channel *c = &IIOBuffer.channels[j];
+            if (c->index > last_index && (!next || c->index < next->index))
+                next = c;
+        }
+        offset = (offset + next->bytes - 1) & ~(next->bytes - 1);
+        next->offset = offset;
+        offset += next->bytes;
+        if (next->bytes > max_bytes)
+            max_bytes = next->bytes;
+        last_index = next->index;
+    }
+    IIOBuffer.scan_size = (offset + max_bytes - 1) & ~(max_bytes - 1);
+
+    if (CONFIG_LINUX_IIO_TRIGGER[0]
+        && iio_sysfs_write("trigger/current_trigger"
+                           , CONFIG_LINUX_IIO_TRIGGER) < 0)
+        shutdown("Unable to set iio trigger");
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", IIO_BUFFER_LENGTH);
+    iio_sysfs_write("buffer/length", buf);
+    if (iio_sysfs_write("buffer/enable", "1") < 0) {
+        report_errno("iio buffer enable", -1);
+        shutdown("Unable to enable iio buffer");
+    }
+    int fd = open(CONFIG_LINUX_IIO_DEVICE, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        report_errno("iio buffer open", fd);
+        shutdown("Unable to open iio buffer device");
+    }
+    if (set_non_blocking(fd) < 0)
+        shutdown("Unable to set non-blocking on iio buffer device");
+    IIOBuffer.fd = fd;
+}
+
+// Extract a channel value from a scan
+static uint16_t
+iio_channel_value(struct iio_channel *c, uint8_t *scan)
+{
+    uint8_t *d = &scan[c->offset];
+    uint32_t v = 0;
+    uint_fast8_t i;
+    for (i=0; i<c->bytes; i++)
+        v = c->is_be ? (v << 8) | d[i] : v | (d[i] << (i * 8));
+    v = (v >> c->shift) & ((1 << c->bits) - 1);
+    if (c->is_signed && v & (1 << (c->bits - 1)))
+        // Negative reading
+        return 0;
+    return v;
+}
+
+// Read all available scans from the device, keeping the newest
+static void
+iio_buffer_drain(void)
+{
+    if (IIOBuffer.fd < 0)
+        iio_buffer_start();
+    IIOBuffer.drain_time = timer_read_time();
+    uint_fast8_t i, count = IIOBuffer.channel_count;
+    for (i=0; i<count; i++)
+        IIOBuffer.channels[i].count = 0;
+    uint8_t buf[IIO_READ_SIZE];
+    int read_size = sizeof(buf) - sizeof(buf) % IIOBuffer.scan_size;
+    for (;;) {
+        int ret = read(IIOBuffer.fd, buf, read_size);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                report_errno("iio buffer read", ret);
+                try_shutdown("Error on iio buffer read");
+            }
+            break;
+        }
+        int pos;
+        for (pos=0; pos + IIOBuffer.scan_size <= ret
+                 ; pos += IIOBuffer.scan_size) {
+            for (i=0; i<count; i++) {
+                struct iio_channel *c = &IIOBuffer.channels[i];
+                c->queue[c->head] = iio_channel_value(c, &buf[pos]);
+                c->head = (c->head + 1) % ARRAY_SIZE(c->queue);
+                if (c->count < ARRAY_SIZE(c->queue))
+                    c->count++;
+            }
+        }
+        if (ret < read_size)
+            break;
+    }
+}
+
+// Return the newest unused sample of a channel
+static uint16_t
+iio_buffer_read(uint8_t slot)
+{
+    struct iio_channel *c = &IIOBuffer.channels[slot];
+    uint32_t max_age = timer_from_us(CONFIG_LINUX_IIO_MAX_AGE * 1000);
+    if (!c->count || timer_read_time() - IIOBuffer.drain_time > max_age)
+        iio_buffer_drain();
+    if (c->count) {
+        c->head = (c->head + ARRAY_SIZE(c->queue) - 1) % ARRAY_SIZE(c->queue);
+        c->count--;
+        c->last = c->queue[c->head];
+    }
+    return c->last;
+}
+
+
+/****************************************************************
+ * Analog input interface
+ ****************************************************************/
+
 struct gpio_adc
 gpio_adc_setup(uint32_t pin)
 {
+    if (CONFIG_LINUX_IIO_BUFFER)
+        return (struct gpio_adc){ .fd = iio_buffer_add_channel(
+                pin - ANALOG_START) };
+
     char fname[256];
     snprintf(fname, sizeof(fname), IIO_PATH, pin-ANALOG_START);
 
@@ -51,6 +322,8 @@ gpio_adc_sample(struct gpio_adc g)
 uint16_t
 gpio_adc_read(struct gpio_adc g)
 {
+    if (CONFIG_LINUX_IIO_BUFFER)
+        return iio_buffer_read(g.fd);
     char buf[64];
     int ret = pread(g.fd, buf, sizeof(buf)-1, 0);
     if (ret <= 0) {
@@ -65,4 +338,7 @@ gpio_adc_read(struct gpio_adc g)
 void
 gpio_adc_cancel_sample(struct gpio_adc g)
 {
+    if (CONFIG_LINUX_IIO_BUFFER)
+        // Start the next query with fresh samples
+        IIOBuffer.channels[g.fd].count = 0;
 }
@@ -20,8 +20,9 @@
 #include "internal.h" // console_setup
 #include "sched.h" // sched_wake_task
 
-static struct pollfd main_pfd[1];
+static struct pollfd main_pfd[2];
 #define MP_TTY_IDX   0
+#define MP_TIMER_IDX 1
 
 // Report 'errno' in a message written to stderr
 void
@@ -85,6 +86,7 @@ console_setup(char *name)
         return -1;
     main_pfd[MP_TTY_IDX].fd = mfd;
     main_pfd[MP_TTY_IDX].events = POLLIN;
+    main_pfd[MP_TIMER_IDX].fd = -1;
 
     // Create symlink to tty
     unlink(name);
@@ -119,7 +121,9 @@ console_setup(char *name)
 
 static struct task_wake console_wake;
 static uint8_t receive_buf[4096];
-static int receive_pos;
+static int receive_start, receive_end;
+static uint8_t transmit_buf[4096];
+static int transmit_len;
 
 void *
 console_receive_buffer(void)
@@ -127,61 +131,111 @@ console_receive_buffer(void)
     return receive_buf;
 }
 
-// Process any incoming commands
-void
-console_task(void)
+// Read any available data into receive_buf
+static int
+console_read(void)
 {
-    if (!sched_check_wake(&console_wake))
-        return;
-
-    // Read data
-    int ret = read(main_pfd[MP_TTY_IDX].fd, &receive_buf[receive_pos]
-                   , sizeof(receive_buf) - receive_pos);
+    if (receive_start && sizeof(receive_buf) - receive_end < MESSAGE_MAX) {
+        // Move partial message to start of buffer to make room
+        receive_end -= receive_start;
+        memmove(receive_buf, &receive_buf[receive_start], receive_end);
+        receive_start = 0;
+    }
+    int ret = read(main_pfd[MP_TTY_IDX].fd, &receive_buf[receive_end]
+                   , sizeof(receive_buf) - receive_end);
     if (ret < 0) {
-        if (errno == EWOULDBLOCK) {
-            ret = 0;
-        } else {
+        if (errno != EWOULDBLOCK)
             report_errno("read", ret);
-            return;
-        }
+        return 0;
     }
-    if (ret == 15 && receive_buf[receive_pos+14] == '\n'
-        && memcmp(&receive_buf[receive_pos], "FORCE_SHUTDOWN\n", 15) == 0)
+    if (ret == 15 && receive_buf[receive_end+14] == '\n'
+        && memcmp(&receive_buf[receive_end], "FORCE_SHUTDOWN\n", 15) == 0)
         shutdown("Force shutdown command");
+    receive_end += ret;
+    return ret;
+}
 
-    // Find and dispatch message blocks in the input
-    int len = receive_pos + ret;
+// Dispatch the next message block in receive_buf (if available)
+static int
+console_dispatch(void)
+{
+    int len = receive_end - receive_start;
+    if (!len)
+        return 0;
     uint_fast8_t pop_count, msglen = len > MESSAGE_MAX ? MESSAGE_MAX : len;
-    ret = command_find_and_dispatch(receive_buf, msglen, &pop_count);
-    if (ret) {
-        len -= pop_count;
-        if (len) {
-            memmove(receive_buf, &receive_buf[pop_count], len);
-            sched_wake_task(&console_wake);
-        }
+    int ret = command_find_and_dispatch(&receive_buf[receive_start], msglen
+                                        , &pop_count);
+    if (!ret)
+        return 0;
+    receive_start += pop_count;
+    if (receive_start >= receive_end)
+        receive_start = receive_end = 0;
+    else
+        sched_wake_task(&console_wake);
+    return 1;
+}
+
+// Write any queued response messages
+void
+console_flush(void)
+{
+    if (!transmit_len)
+        return;
+    int ret = write(main_pfd[MP_TTY_IDX].fd, transmit_buf, transmit_len);
+    if (ret < 0) {
+        if (errno != EWOULDBLOCK)
+            report_errno("write", ret);
+        return;
     }
-    receive_pos = len;
+    transmit_len -= ret;
+    if (transmit_len)
+        memmove(transmit_buf, &transmit_buf[ret], transmit_len);
+}
+
+// Process any incoming commands
+void
+console_task(void)
+{
+    console_flush();
+    if (!sched_check_wake(&console_wake))
+        return;
+
+    // Dispatch buffered message blocks before reading more data
+    if (console_dispatch())
+        return;
+    if (console_read())
+        console_dispatch();
 }
 DECL_TASK(console_task);
 
-// Encode and transmit a "response" message
+// Encode a "response" message (it is transmitted by console_flush())
 void
 console_sendf(const struct command_encoder *ce, va_list args)
 {
-    // Generate message
-    uint8_t buf[MESSAGE_MAX];
-    uint_fast8_t msglen = command_encode_and_frame(buf, ce, args);
-
-    // Transmit message
-    int ret = write(main_pfd[MP_TTY_IDX].fd, buf, msglen);
-    if (ret < 0)
-        report_errno("write", ret);
+    if (transmit_len + MESSAGE_MAX > sizeof(transmit_buf)) {
+        console_flush();
+        if (transmit_len + MESSAGE_MAX > sizeof(transmit_buf)) {
+            fprintf(stderr, "Console transmit buffer full\n");
+            return;
+        }
+    }
+    transmit_len += command_encode_and_frame(&transmit_buf[transmit_len]
+                                             , ce, args);
+}
+
+// Also wake console_sleep() when the given timerfd expires
+void
+console_set_timer_fd(int fd)
+{
+    main_pfd[MP_TIMER_IDX].fd = fd;
+    main_pfd[MP_TIMER_IDX].events = POLLIN;
 }
 
 // Sleep until a signal received (waking early for console input if needed)
 void
 console_sleep(sigset_t *sigset)
 {
+    console_flush();
     int ret = ppoll(main_pfd, ARRAY_SIZE(main_pfd), NULL, sigset);
     if (ret <= 0) {
         if (errno != EINTR)
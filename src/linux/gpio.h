@@ -35,6 +35,10 @@ struct spi_config spi_setup(uint32_t bus, uint8_t mode, uint32_t rate);
 void spi_prepare(struct spi_config config);
 void spi_transfer(struct spi_config config, uint8_t receive_data
                   , uint8_t len, uint8_t *data);
+#define SPI_MULTI_MAX 16
+struct spidev_xfer;
+void spi_transfer_multi(struct spi_config config, uint8_t count
+                        , struct spidev_xfer *xfers);
 
 struct gpio_pwm {
     int duty_fd, enable_fd;
@@ -19,7 +19,9 @@ void report_errno(char *where, int rc);
 int set_non_blocking(int fd);
 int set_close_on_exec(int fd);
 int console_setup(char *name);
+void console_flush(void);
 void console_sleep(sigset_t *sigset);
+void console_set_timer_fd(int fd);
 
 // timer.c
 int timer_check_periodic(uint32_t *ts);
@@ -4,9 +4,12 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#define _GNU_SOURCE
 #include </usr/include/sched.h> // sched_setscheduler
 #include <stdio.h> // fprintf
+#include <stdlib.h> // atoi
 #include <string.h> // memset
+#include <sys/mman.h> // mlockall
 #include <unistd.h> // getopt
 #include "board/misc.h" // console_sendf
 #include "command.h" // DECL_CONSTANT
@@ -34,6 +37,33 @@ realtime_setup(void)
     return 0;
 }
 
+// Only run on the given cpu
+static int
+cpu_setup(int cpu)
+{
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    int ret = sched_setaffinity(0, sizeof(cs), &cs);
+    if (ret < 0) {
+        report_errno("sched_setaffinity", ret);
+        return -1;
+    }
+    return 0;
+}
+
+// Avoid page faults by locking all memory into ram
+static int
+memlock_setup(void)
+{
+    int ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (ret < 0) {
+        report_errno("mlockall", ret);
+        return -1;
+    }
+    return 0;
+}
+
 
 /****************************************************************
  * Restart
@@ -46,6 +76,7 @@ command_config_reset(uint32_t *args)
 {
     if (! sched_is_shutdown())
         shutdown("config_reset only available when shutdown");
+    console_flush();
     int ret = execv(orig_argv[0], orig_argv);
     report_errno("execv", ret);
 }
@@ -61,8 +92,8 @@ main(int argc, char **argv)
 {
     // Parse program args
     orig_argv = argv;
-    int opt, watchdog = 0, realtime = 0;
-    while ((opt = getopt(argc, argv, "wr")) != -1) {
+    int opt, watchdog = 0, realtime = 0, memlock = 0, cpu = -1;
+    while ((opt = getopt(argc, argv, "wrmc:")) != -1) {
         switch (opt) {
         case 'w':
             watchdog = 1;
@@ -70,8 +101,15 @@ main(int argc, char **argv)
         case 'r':
             realtime = 1;
             break;
+        case 'm':
+            memlock = 1;
+            break;
+        case 'c':
+            cpu = atoi(optarg);
+            break;
         default:
-            fprintf(stderr, "Usage: %s [-w] [-r]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-w] [-r] [-m] [-c <cpu>]\n"
+                    , argv[0]);
             return -1;
         }
     }
@@ -82,6 +120,16 @@ main(int argc, char **argv)
         if (ret)
             return ret;
     }
+    if (cpu >= 0) {
+        int ret = cpu_setup(cpu);
+        if (ret)
+            return ret;
+    }
+    if (memlock) {
+        int ret = memlock_setup();
+        if (ret)
+            return ret;
+    }
     int ret = console_setup("/tmp/klipper_host_mcu");
     if (ret)
         return -1;
@@ -14,6 +14,7 @@
 #include "gpio.h" // spi_setup
 #include "internal.h" // report_errno
 #include "sched.h" // shutdown
+#include "spicmds.h" // struct spidev_xfer
 
 #define SPIBUS(chip, pin) (((chip)<<8) + (pin))
 #define SPIBUS_TO_BUS(spi_bus) ((spi_bus) >> 8)
@@ -117,3 +118,36 @@ spi_transfer(struct spi_config config, uint8_t receive_data
         }
     }
 }
+
+// Issue several transfers with a single ioctl (chip select is
+// released between each transfer)
+void
+spi_transfer_multi(struct spi_config config, uint8_t count
+                   , struct spidev_xfer *xfers)
+{
+    if (!count)
+        return;
+    if (count > SPI_MULTI_MAX)
+        shutdown("Too many spi transfers");
+    struct spi_ioc_transfer transfers[SPI_MULTI_MAX];
+    memset(transfers, 0, sizeof(transfers[0]) * count);
+    int i;
+    for (i=0; i<count; i++) {
+        struct spi_ioc_transfer *t = &transfers[i];
+        struct spidev_xfer *x = &xfers[i];
+        t->tx_buf = (uintptr_t)x->data;
+        if (x->receive_data)
+            t->rx_buf = (uintptr_t)x->data;
+        t->len = x->len;
+        t->speed_hz = config.rate;
+        t->bits_per_word = 8;
+        t->delay_usecs = x->delay_us;
+        // On the last transfer cs_change would leave the device selected
+        t->cs_change = i < count - 1;
+    }
+    int ret = ioctl(config.fd, SPI_IOC_MESSAGE(count), transfers);
+    if (ret < 0) {
+        report_errno("spi ioctl", ret);
+        try_shutdown("Unable to issue spi ioctl");
+    }
+}
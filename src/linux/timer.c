@@ -4,6 +4,8 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include <string.h> // memcpy
+#include <sys/timerfd.h> // timerfd_create
 #include <time.h> // struct timespec
 #include "autoconf.h" // CONFIG_CLOCK_FREQ
 #include "board/io.h" // readl
@@ -13,6 +15,8 @@
 #include "internal.h" // console_sleep
 #include "sched.h" // DECL_INIT
 
+#define TIMER_JITTER_BUCKETS 12
+
 // Global storage for timer handling
 static struct {
     // Last time reported by timer_read_time()
@@ -27,6 +31,11 @@ static struct {
     // Unix signal tracking
     timer_t t_alarm;
     sigset_t ss_alarm, ss_sleep;
+    // timerfd based wakeup (CONFIG_LINUX_TIMERFD)
+    int timer_fd;
+    // Wake jitter tracking
+    uint32_t wake_pending, jitter_max;
+    uint32_t jitter_counts[TIMER_JITTER_BUCKETS];
 } TimerInfo;
 
 
@@ -118,10 +127,63 @@ timer_read_time(void)
 void
 timer_kick(void)
 {
+    TimerInfo.wake_pending = 0;
+    if (CONFIG_LINUX_TIMERFD) {
+        TimerInfo.must_wake_timers = 1;
+        return;
+    }
     struct itimerspec it = { .it_interval = {0, 0}, .it_value = {0, 1} };
     timer_settime(TimerInfo.t_alarm, TIMER_ABSTIME, &it, NULL);
 }
 
+// Check if the next scheduled timer is ready to run
+static int
+timer_is_due(void)
+{
+    return !timer_is_before(timer_read_time(), TimerInfo.next_wake_counter);
+}
+
+
+/****************************************************************
+ * Wake jitter histogram
+ ****************************************************************/
+
+// Note the delay between a timer's scheduled wake time and the
+// actual start of timer dispatch.  Counts are kept in buckets of
+// power of two microseconds (<1us, <2us, <4us, ..., >=1024us).
+static void
+timer_note_jitter(void)
+{
+    uint32_t jitter = timer_read_time() - TimerInfo.next_wake_counter;
+    if ((int32_t)jitter < 0)
+        jitter = 0;
+    if (jitter > TimerInfo.jitter_max)
+        TimerInfo.jitter_max = jitter;
+    uint32_t us = jitter / (CONFIG_CLOCK_FREQ / 1000000);
+    uint32_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= TIMER_JITTER_BUCKETS)
+        bucket = TIMER_JITTER_BUCKETS - 1;
+    TimerInfo.jitter_counts[bucket]++;
+}
+
+// Report the wake jitter histogram (counts are cumulative; the
+// maximum is reset on each query)
+void
+command_get_timer_jitter(uint32_t *args)
+{
+    uint8_t counts[sizeof(TimerInfo.jitter_counts)];
+    memcpy(counts, TimerInfo.jitter_counts, sizeof(counts));
+    uint32_t max = TimerInfo.jitter_max;
+    TimerInfo.jitter_max = 0;
+    sendf("timer_jitter max=%u counts=%*s", max, (int)sizeof(counts), counts);
+}
+DECL_COMMAND(command_get_timer_jitter, "get_timer_jitter");
+
+
+/****************************************************************
+ * Timer dispatch
+ ****************************************************************/
+
 #define TIMER_IDLE_REPEAT_COUNT 100
 #define TIMER_REPEAT_COUNT 20
 
@@ -132,6 +194,10 @@ static void
 timer_dispatch(void)
 {
     uint32_t repeat_count = TIMER_REPEAT_COUNT, next;
+    if (TimerInfo.wake_pending) {
+        TimerInfo.wake_pending = 0;
+        timer_note_jitter();
+    }
     for (;;) {
         // Run the next software timer
         next = sched_timer_dispatch();
@@ -162,13 +228,17 @@ timer_dispatch(void)
             diff = next - timer_read_time();
     }
 
-    // Schedule SIGALRM signal
+    // Schedule SIGALRM signal (or timerfd wakeup)
     struct itimerspec it;
     it.it_interval = (struct timespec){0, 0};
     TimerInfo.next_wake = it.it_value = timespec_from_time(next);
     TimerInfo.next_wake_counter = next;
     TimerInfo.must_wake_timers = 0;
-    timer_settime(TimerInfo.t_alarm, TIMER_ABSTIME, &it, NULL);
+    TimerInfo.wake_pending = 1;
+    if (CONFIG_LINUX_TIMERFD)
+        timerfd_settime(TimerInfo.timer_fd, TFD_TIMER_ABSTIME, &it, NULL);
+    else
+        timer_settime(TimerInfo.t_alarm, TIMER_ABSTIME, &it, NULL);
 }
 
 // OS signal handler
@@ -178,9 +248,32 @@ timer_signal(int signal)
     TimerInfo.must_wake_timers = 1;
 }
 
+// Setup timerfd based timer wakeups
+static void
+timer_init_fd(void)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        report_errno("timerfd_create", fd);
+        return;
+    }
+    TimerInfo.timer_fd = fd;
+    console_set_timer_fd(fd);
+}
+
 void
 timer_init(void)
 {
+    // Initialize timespec_to_time() and timespec_from_time()
+    struct timespec curtime = timespec_read();
+    TimerInfo.start_sec = curtime.tv_sec + 1;
+    TimerInfo.next_wake = curtime;
+    TimerInfo.next_wake_counter = timespec_to_time(curtime);
+    if (CONFIG_LINUX_TIMERFD) {
+        timer_init_fd();
+        timer_kick();
+        return;
+    }
     // Initialize ss_alarm signal set
     int ret = sigemptyset(&TimerInfo.ss_alarm);
     if (ret < 0) {
@@ -203,11 +296,6 @@ timer_init(void)
         report_errno("sigdelset", ret);
         return;
     }
-    // Initialize timespec_to_time() and timespec_from_time()
-    struct timespec curtime = timespec_read();
-    TimerInfo.start_sec = curtime.tv_sec + 1;
-    TimerInfo.next_wake = curtime;
-    TimerInfo.next_wake_counter = timespec_to_time(curtime);
     // Initialize t_alarm signal based timer
     ret = timer_create(CLOCK_MONOTONIC, NULL, &TimerInfo.t_alarm);
     if (ret < 0) {
@@ -267,6 +355,13 @@ irq_restore(irqstatus_t flag)
 void
 irq_wait(void)
 {
+    if (CONFIG_LINUX_TIMERFD) {
+        // Sleep until console input or the timerfd expires
+        if (!readl(&TimerInfo.must_wake_timers) && !timer_is_due())
+            console_sleep(NULL);
+        irq_poll();
+        return;
+    }
     // Must atomically sleep until signaled
     if (!readl(&TimerInfo.must_wake_timers)) {
         timer_disable_signals();
@@ -280,6 +375,7 @@ irq_wait(void)
 void
 irq_poll(void)
 {
-    if (readl(&TimerInfo.must_wake_timers))
+    if (readl(&TimerInfo.must_wake_timers)
+        || (CONFIG_LINUX_TIMERFD && timer_is_due()))
         timer_dispatch();
 }
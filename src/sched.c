@@ -15,13 +15,24 @@
 #include "sched.h" // sched_check_periodic
 #include "stepper.h" // stepper_event
 
-static struct timer periodic_timer, sentinel_timer, deleted_timer;
+static struct timer periodic_timer, sentinel_timer;
 
 static struct {
+#if CONFIG_SCHED_TIMER_HEAP
+    struct timer *timer_heap[CONFIG_SCHED_TIMER_HEAP_SIZE];
+    uint_fast16_t heap_count;
+#else
     struct timer *timer_list, *last_insert;
+#endif
     int8_t tasks_status;
     uint8_t shutdown_status, shutdown_reason;
-} SchedStatus = {.timer_list = &periodic_timer, .last_insert = &periodic_timer};
+} SchedStatus = {
+#if CONFIG_SCHED_TIMER_HEAP
+    .timer_heap = { &periodic_timer }, .heap_count = 1,
+#else
+    .timer_list = &periodic_timer, .last_insert = &periodic_timer,
+#endif
+};
 
 
 /****************************************************************
@@ -63,6 +74,332 @@ static struct timer sentinel_timer = {
     .waketime = 0x80000000,
 };
 
+
+/****************************************************************
+ * Profiling
+ ****************************************************************/
+
+#if CONFIG_SCHED_PROFILE
+
+DECL_CONSTANT("SCHED_PROFILE_TIMERS", CONFIG_SCHED_PROFILE_TIMERS);
+DECL_CTR("_DECL_CALLLIST_PROFILE ctr_run_taskfuncs sched_profile_task task");
+
+typedef uint_fast8_t (*timer_func_t)(struct timer*);
+
+static struct {
+    struct {
+        timer_func_t func;
+        struct sched_profile_stat stat;
+        uint32_t max_latency;
+    } timers[CONFIG_SCHED_PROFILE_TIMERS];
+    uint8_t timer_count, last_timer;
+} SchedProfile;
+
+// Add an execution time to a set of statistics
+static void
+profile_update(struct sched_profile_stat *s, uint32_t start, uint32_t end)
+{
+    uint32_t diff = end - start;
+    s->count++;
+    s->sum += diff;
+    if (diff > s->max)
+        s->max = diff;
+}
+
+static uint32_t
+profile_timer_start(void)
+{
+    return timer_read_time();
+}
+
+// Note the execution time of a timer callback (called with irqs off)
+static void
+profile_timer(timer_func_t func, uint32_t waketime, uint32_t start)
+{
+    uint32_t end = timer_read_time();
+    if (!func)
+        // Inlined stepper_event() call
+        func = stepper_event;
+    uint_fast8_t i = SchedProfile.last_timer;
+    if (SchedProfile.timers[i].func != func) {
+        uint_fast8_t count = SchedProfile.timer_count;
+        for (i = 0; i < count; i++)
+            if (SchedProfile.timers[i].func == func)
+                break;
+        if (i >= count) {
+            if (count < CONFIG_SCHED_PROFILE_TIMERS - 1)
+                SchedProfile.timer_count = count + 1;
+            else
+                // Table full - group remaining callbacks in last entry
+                func = NULL, i = CONFIG_SCHED_PROFILE_TIMERS - 1;
+            SchedProfile.timers[i].func = func;
+        }
+        SchedProfile.last_timer = i;
+    }
+    profile_update(&SchedProfile.timers[i].stat, start, end);
+    int32_t latency = start - waketime;
+    if (latency > (int32_t)SchedProfile.timers[i].max_latency)
+        SchedProfile.timers[i].max_latency = latency;
+}
+
+// Run a task and note its execution time (called from ctr_run_taskfuncs)
+void
+sched_profile_task(struct sched_profile_stat *s, void (*func)(void))
+{
+    uint32_t start = timer_read_time();
+    func();
+    profile_update(s, start, timer_read_time());
+}
+
+// Report the statistics of a task (the statistics are cumulative,
+// except for the maximum which is reset on each query)
+void
+command_sched_profile_get_task(uint32_t *args)
+{
+    uint8_t task = args[0];
+    extern struct sched_profile_stat *ctr_run_taskfuncs_profile_lookup(
+        uint_fast8_t id);
+    struct sched_profile_stat *s = ctr_run_taskfuncs_profile_lookup(task);
+    if (!s)
+        shutdown("Invalid task id");
+    uint32_t count = s->count, sum = s->sum, max = s->max;
+    s->max = 0;
+    sendf("sched_profile_task task=%c count=%u sum=%u max=%u"
+          , task, count, sum, max);
+}
+DECL_COMMAND(command_sched_profile_get_task, "sched_profile_get_task task=%c");
+
+// Report the statistics of a profiled timer callback
+void
+command_sched_profile_get_timer(uint32_t *args)
+{
+    uint8_t idx = args[0];
+    if (idx >= CONFIG_SCHED_PROFILE_TIMERS)
+        shutdown("Invalid timer profile index");
+    irq_disable();
+    timer_func_t func = NULL;
+    struct sched_profile_stat stat = { 0, 0, 0 };
+    uint32_t max_latency = 0;
+    if (idx < SchedProfile.timer_count
+        || (idx == CONFIG_SCHED_PROFILE_TIMERS - 1)) {
+        func = SchedProfile.timers[idx].func;
+        stat = SchedProfile.timers[idx].stat;
+        max_latency = SchedProfile.timers[idx].max_latency;
+        SchedProfile.timers[idx].stat.max = 0;
+        SchedProfile.timers[idx].max_latency = 0;
+    }
+    irq_enable();
+    sendf("sched_profile_timer index=%c func=%u count=%u sum=%u max=%u"
+          " max_latency=%u", idx, (uint32_t)(size_t)func, stat.count, stat.sum
+          , stat.max, max_latency);
+}
+DECL_COMMAND(command_sched_profile_get_timer
+             , "sched_profile_get_timer index=%c");
+
+#else // !CONFIG_SCHED_PROFILE
+
+static inline uint32_t
+profile_timer_start(void)
+{
+    return 0;
+}
+
+static inline void
+profile_timer(uint_fast8_t (*func)(struct timer*), uint32_t waketime
+              , uint32_t start)
+{
+}
+
+#endif // !CONFIG_SCHED_PROFILE
+
+#if CONFIG_SCHED_TIMER_HEAP
+
+/****************************************************************
+ * Timer heap
+ ****************************************************************/
+
+// On micro-controllers with sufficient ram the timers may be stored
+// in a binary heap (ordered by waketime) instead of a sorted list.
+// This makes adding, rescheduling, and deleting a timer O(log n) in
+// the number of active timers.  Each timer records its position in
+// the heap.  The periodic_timer is always present in the heap, which
+// ensures all timers have a waketime within 2^31 ticks of each other.
+
+// Store a timer at the given position of the heap
+static inline void
+heap_set(uint_fast16_t pos, struct timer *t)
+{
+    SchedStatus.timer_heap[pos] = t;
+    t->heap_pos = pos;
+}
+
+// Move a timer towards the root of the heap until ordered
+static void
+heap_sift_up(struct timer *t, uint_fast16_t pos)
+{
+    struct timer **heap = SchedStatus.timer_heap;
+    uint32_t waketime = t->waketime;
+    while (pos) {
+        uint_fast16_t parent = (pos - 1) / 2;
+        struct timer *pt = heap[parent];
+        if (!timer_is_before(waketime, pt->waketime))
+            break;
+        heap_set(pos, pt);
+        pos = parent;
+    }
+    heap_set(pos, t);
+}
+
+// Move a timer away from the root of the heap until ordered
+static void
+heap_sift_down(struct timer *t, uint_fast16_t pos)
+{
+    struct timer **heap = SchedStatus.timer_heap;
+    uint_fast16_t count = SchedStatus.heap_count;
+    uint32_t waketime = t->waketime;
+    for (;;) {
+        uint_fast16_t child = pos * 2 + 1;
+        if (child >= count)
+            break;
+        struct timer *ct = heap[child];
+        if (child + 1 < count
+            && timer_is_before(heap[child + 1]->waketime, ct->waketime))
+            ct = heap[++child];
+        if (!timer_is_before(ct->waketime, waketime))
+            break;
+        heap_set(pos, ct);
+        pos = child;
+    }
+    heap_set(pos, t);
+}
+
+// Find the position of a timer in the heap (or -1 if not present)
+static int_fast16_t
+heap_find(struct timer *t)
+{
+    uint_fast16_t pos = t->heap_pos;
+    if (pos < SchedStatus.heap_count && SchedStatus.timer_heap[pos] == t)
+        return pos;
+    return -1;
+}
+
+// Remove the timer at the given position of the heap
+static void
+heap_remove(uint_fast16_t pos)
+{
+    uint_fast16_t count = --SchedStatus.heap_count;
+    if (pos == count)
+        return;
+    struct timer *last = SchedStatus.timer_heap[count];
+    heap_sift_down(last, pos);
+    if (SchedStatus.timer_heap[pos] == last)
+        heap_sift_up(last, pos);
+}
+
+// Schedule a function call at a supplied time.
+void
+sched_add_timer(struct timer *add)
+{
+    uint32_t waketime = add->waketime;
+    irqstatus_t flag = irq_save();
+    if (unlikely(SchedStatus.heap_count >= CONFIG_SCHED_TIMER_HEAP_SIZE))
+        shutdown("Too many timers");
+    if (unlikely(timer_is_before(waketime
+                                 , SchedStatus.timer_heap[0]->waketime))) {
+        // This timer is before all other scheduled timers
+        if (timer_is_before(waketime, timer_read_time()))
+            try_shutdown("Timer too close");
+        timer_kick();
+    }
+    heap_sift_up(add, SchedStatus.heap_count++);
+    irq_restore(flag);
+}
+
+// The deleted timer is used when deleting the next active timer.
+static uint_fast8_t
+deleted_event(struct timer *t)
+{
+    return SF_DONE;
+}
+
+static struct timer deleted_timer = {
+    .func = deleted_event,
+};
+
+// Remove a timer that may be live.
+void
+sched_del_timer(struct timer *del)
+{
+    irqstatus_t flag = irq_save();
+    int_fast16_t pos = heap_find(del);
+    if (pos == 0) {
+        // Deleting the next active timer - the hardware timer may
+        // already be armed for it, so replace it with deleted_timer
+        int_fast16_t dpos = heap_find(&deleted_timer);
+        if (dpos > 0)
+            heap_remove(dpos);
+        deleted_timer.waketime = del->waketime;
+        heap_set(0, &deleted_timer);
+    } else if (pos > 0) {
+        heap_remove(pos);
+    }
+    irq_restore(flag);
+}
+
+// The dispatch timer holds the heap position of a timer while its
+// callback runs.  The callback may therefore delete its own timer
+// (which has no effect) and add other timers; its return code alone
+// determines if the timer is rescheduled.  As with the timer list, a
+// callback must not add its own timer.
+static struct timer dispatch_timer;
+
+// Invoke the next timer - called from board hardware irq code.
+unsigned int
+sched_timer_dispatch(void)
+{
+    // Invoke timer callback
+    struct timer **heap = SchedStatus.timer_heap, *t = heap[0];
+    uint_fast8_t (*func)(struct timer*) = t->func;
+    uint32_t waketime = t->waketime, pstart = profile_timer_start();
+    dispatch_timer.waketime = waketime;
+    heap_set(0, &dispatch_timer);
+    uint_fast8_t res;
+    if (CONFIG_INLINE_STEPPER_HACK && likely(!func))
+        res = stepper_event(t);
+    else
+        res = func(t);
+    profile_timer(func, waketime, pstart);
+
+    // Update timer_heap (rescheduling current timer if necessary)
+    int_fast16_t pos = dispatch_timer.heap_pos;
+    if (unlikely(res == SF_DONE)) {
+        heap_remove(pos);
+    } else {
+        heap_sift_down(t, pos);
+        if (unlikely(heap[pos] == t))
+            heap_sift_up(t, pos);
+    }
+
+    return heap[0]->waketime;
+}
+
+// Remove all user timers
+void
+sched_timer_reset(void)
+{
+    heap_set(0, &periodic_timer);
+    SchedStatus.heap_count = 1;
+    timer_kick();
+}
+
+#else // !CONFIG_SCHED_TIMER_HEAP
+
+/****************************************************************
+ * Timer list
+ ****************************************************************/
+
+static struct timer deleted_timer;
+
 // Find position for a timer in timer_list and insert it
 static void __always_inline
 insert_timer(struct timer *pos, struct timer *t, uint32_t waketime)
@@ -148,15 +485,18 @@ sched_timer_dispatch(void)
 {
     // Invoke timer callback
     struct timer *t = SchedStatus.timer_list;
+    uint_fast8_t (*func)(struct timer*) = t->func;
+    uint32_t waketime = t->waketime, pstart = profile_timer_start();
     uint_fast8_t res;
     uint32_t updated_waketime;
-    if (CONFIG_INLINE_STEPPER_HACK && likely(!t->func)) {
+    if (CONFIG_INLINE_STEPPER_HACK && likely(!func)) {
         res = stepper_event(t);
         updated_waketime = t->waketime;
     } else {
-        res = t->func(t);
+        res = func(t);
         updated_waketime = t->waketime;
     }
+    profile_timer(func, waketime, pstart);
 
     // Update timer_list (rescheduling current timer if necessary)
     unsigned int next_waketime = updated_waketime;
@@ -189,6 +529,8 @@ sched_timer_reset(void)
     timer_kick();
 }
 
+#endif // !CONFIG_SCHED_TIMER_HEAP
+
 
 /****************************************************************
  * Tasks
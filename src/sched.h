@@ -2,6 +2,7 @@
 #define __SCHED_H
 
 #include <stdint.h> // uint32_t
+#include "autoconf.h" // CONFIG_SCHED_TIMER_HEAP
 #include "ctr.h" // DECL_CTR
 
 // Declare an init function (called at firmware startup)
@@ -16,6 +17,9 @@ struct timer {
     struct timer *next;
     uint_fast8_t (*func)(struct timer*);
     uint32_t waketime;
+#if CONFIG_SCHED_TIMER_HEAP
+    uint16_t heap_pos;
+#endif
 };
 
 enum { SF_DONE=0, SF_RESCHEDULE=1 };
@@ -25,6 +29,11 @@ struct task_wake {
     uint8_t wake;
 };
 
+// Execution time statistics (see CONFIG_SCHED_PROFILE)
+struct sched_profile_stat {
+    uint32_t count, sum, max;
+};
+
 // sched.c
 void sched_add_timer(struct timer*);
 void sched_del_timer(struct timer *del);
@@ -40,6 +49,7 @@ void sched_try_shutdown(uint_fast8_t reason);
 void sched_shutdown(uint_fast8_t reason) __noreturn;
 void sched_report_shutdown(void);
 void sched_main(void);
+void sched_profile_task(struct sched_profile_stat *s, void (*func)(void));
 
 // Compiler glue for DECL_X macros above.
 #define _DECL_CALLLIST(NAME, FUNC)                                      \
@@ -17,10 +17,18 @@ struct adxl345 {
     uint32_t rest_ticks;
     struct spidev_s *spi;
     uint16_t sequence, limit_count;
-    uint8_t flags, data_count;
+    uint8_t flags, data_count, encoding, sample_count, pred_count;
+    int16_t last[3], last2[3];
     uint8_t data[50];
 };
 
+enum { AE_RAW, AE_DELTA };
+
+// Delta encoded samples use at most 3 bytes per axis
+#define DELTA_MAX_SAMPLE_SIZE 9
+// Zigzag code reported in place of a sample on a data error
+#define DELTA_ERROR 0xffff
+
 enum {
     AX_HAVE_START = 1<<0, AX_RUNNING = 1<<1, AX_PENDING = 1<<2,
 };
@@ -47,6 +55,17 @@ command_config_adxl345(uint32_t *args)
 }
 DECL_COMMAND(command_config_adxl345, "config_adxl345 oid=%c spi_oid=%c");
 
+void
+command_set_adxl345_encoding(uint32_t *args)
+{
+    struct adxl345 *ax = oid_lookup(args[0], command_config_adxl345);
+    if (args[1] > AE_DELTA)
+        shutdown("Invalid adxl345 encoding");
+    ax->encoding = args[1];
+}
+DECL_COMMAND(command_set_adxl345_encoding,
+             "set_adxl345_encoding oid=%c encoding=%c");
+
 // Report local measurement buffer
 static void
 adxl_report(struct adxl345 *ax, uint8_t oid)
@@ -54,7 +73,13 @@ adxl_report(struct adxl345 *ax, uint8_t oid)
     sendf("adxl345_data oid=%c sequence=%hu data=%*s"
           , oid, ax->sequence, ax->data_count, ax->data);
     ax->data_count = 0;
-    ax->sequence++;
+    if (ax->encoding == AE_DELTA) {
+        // In delta mode the sequence is the index of the first sample
+        ax->sequence += ax->sample_count;
+        ax->sample_count = ax->pred_count = 0;
+    } else {
+        ax->sequence++;
+    }
 }
 
 // Report buffer and fifo status
@@ -65,7 +90,8 @@ adxl_status(struct adxl345 *ax, uint_fast8_t oid
     sendf("adxl345_status oid=%c clock=%u query_ticks=%u next_sequence=%hu"
           " buffered=%c fifo=%c limit_count=%hu"
           , oid, time1, time2-time1, ax->sequence
-          , ax->data_count, fifo, ax->limit_count);
+          , ax->encoding == AE_DELTA ? ax->sample_count : ax->data_count
+          , fifo, ax->limit_count);
 }
 
 // Helper code to reschedule the adxl345_event() timer
@@ -87,37 +113,118 @@ adxl_reschedule_timer(struct adxl345 *ax)
 
 #define SET_FIFO_CTL 0x90
 
-// Query accelerometer data
+// Maximum number of fifo entries to read per task invocation
+#define BURST_COUNT 8
+// The chip needs 5us after a data read to pop the next fifo entry
+#define FIFO_POP_TIME 5
+
+// Append a varint encoded value to the measurement buffer
 static void
-adxl_query(struct adxl345 *ax, uint8_t oid)
+adxl_add_varint(struct adxl345 *ax, uint_fast16_t z)
+{
+    uint8_t *d = &ax->data[ax->data_count];
+    while (z >= 0x80) {
+        *d++ = z | 0x80;
+        z >>= 7;
+    }
+    *d++ = z;
+    ax->data_count = d - ax->data;
+}
+
+// Append a sample as the difference from a linear prediction based
+// on the previous two samples in this message
+static void
+adxl_add_delta(struct adxl345 *ax, uint8_t *msg, int error)
+{
+    ax->sample_count++;
+    if (error) {
+        adxl_add_varint(ax, DELTA_ERROR);
+        return;
+    }
+    uint_fast8_t i, pred_count = ax->pred_count;
+    for (i=0; i<3; i++) {
+        int16_t v = msg[i*2 + 1] | (msg[i*2 + 2] << 8), pred = 0;
+        if (pred_count == 1)
+            pred = ax->last[i];
+        else if (pred_count >= 2)
+            pred = 2 * ax->last[i] - ax->last2[i];
+        // Zigzag encode the residual so small negative values stay small
+        int_fast16_t r = v - pred;
+        adxl_add_varint(ax, r < 0 ? -2*r - 1 : 2*r);
+        ax->last2[i] = ax->last[i];
+        ax->last[i] = v;
+    }
+    if (pred_count < 2)
+        ax->pred_count = pred_count + 1;
+}
+
+// Store one fifo entry (as read from the chip) in the local buffer
+static uint_fast8_t
+adxl_add_entry(struct adxl345 *ax, uint8_t oid, uint8_t *msg)
 {
-    // Read data
-    uint8_t msg[9] = { AR_DATAX0 | AM_READ | AM_MULTI, 0, 0, 0, 0, 0, 0, 0, 0 };
-    spidev_transfer(ax->spi, 1, sizeof(msg), msg);
     // Extract x, y, z measurements
     uint_fast8_t fifo_status = msg[8] & ~0x80; // Ignore trigger bit
-    uint8_t *d = &ax->data[ax->data_count];
-    if (((msg[2] & 0xf0) && (msg[2] & 0xf0) != 0xf0)
-        || ((msg[4] & 0xf0) && (msg[4] & 0xf0) != 0xf0)
-        || ((msg[6] & 0xf0) && (msg[6] & 0xf0) != 0xf0)
-        || (msg[7] != SET_FIFO_CTL) || (fifo_status > 32)) {
+    int error = (((msg[2] & 0xf0) && (msg[2] & 0xf0) != 0xf0)
+                 || ((msg[4] & 0xf0) && (msg[4] & 0xf0) != 0xf0)
+                 || ((msg[6] & 0xf0) && (msg[6] & 0xf0) != 0xf0)
+                 || (msg[7] != SET_FIFO_CTL) || (fifo_status > 32));
+    if (error)
         // Data error - may be a CS, MISO, MOSI, or SCLK glitch
-        d[0] = d[1] = d[2] = d[3] = d[4] = 0xff;
         fifo_status = 0;
+    if (ax->encoding == AE_DELTA) {
+        adxl_add_delta(ax, msg, error);
+        if (ax->data_count + DELTA_MAX_SAMPLE_SIZE > ARRAY_SIZE(ax->data))
+            adxl_report(ax, oid);
     } else {
-        // Copy data
-        d[0] = msg[1]; // x low bits
-        d[1] = msg[3]; // y low bits
-        d[2] = msg[5]; // z low bits
-        d[3] = (msg[2] & 0x1f) | (msg[6] << 5); // x high bits and z high bits
-        d[4] = (msg[4] & 0x1f) | ((msg[6] << 2) & 0x60); // y high and z high
+        uint8_t *d = &ax->data[ax->data_count];
+        if (error) {
+            d[0] = d[1] = d[2] = d[3] = d[4] = 0xff;
+        } else {
+            // Copy data
+            d[0] = msg[1]; // x low bits
+            d[1] = msg[3]; // y low bits
+            d[2] = msg[5]; // z low bits
+            d[3] = (msg[2] & 0x1f) | (msg[6] << 5); // x high and z high
+            d[4] = (msg[4] & 0x1f) | ((msg[6] << 2) & 0x60); // y high, z high
+        }
+        ax->data_count += 5;
+        if (ax->data_count + 5 > ARRAY_SIZE(ax->data))
+            adxl_report(ax, oid);
     }
-    ax->data_count += 5;
-    if (ax->data_count + 5 > ARRAY_SIZE(ax->data))
-        adxl_report(ax, oid);
-    // Check fifo status
     if (fifo_status >= 31)
         ax->limit_count++;
+    return fifo_status;
+}
+
+// Query accelerometer data
+static void
+adxl_query(struct adxl345 *ax, uint8_t oid)
+{
+    // Read one fifo entry to find out how many entries are available
+    uint8_t msg[BURST_COUNT - 1][9] = {
+        { AR_DATAX0 | AM_READ | AM_MULTI, 0, 0, 0, 0, 0, 0, 0, 0 } };
+    spidev_transfer(ax->spi, 1, sizeof(msg[0]), msg[0]);
+    uint_fast8_t fifo_status = adxl_add_entry(ax, oid, msg[0]);
+    if (fifo_status > 1 && fifo_status <= 32) {
+        // Drain up to BURST_COUNT-1 more entries in one batch (CS is
+        // released between reads)
+        struct spidev_xfer xfers[ARRAY_SIZE(msg)];
+        uint_fast8_t i, count = fifo_status - 1;
+        if (count > ARRAY_SIZE(xfers))
+            count = ARRAY_SIZE(xfers);
+        for (i=0; i<count; i++) {
+            memset(msg[i], 0, sizeof(msg[i]));
+            msg[i][0] = AR_DATAX0 | AM_READ | AM_MULTI;
+            xfers[i] = (struct spidev_xfer){
+                .data = msg[i], .len = sizeof(msg[i]), .receive_data = 1,
+                .delay_us = i < count - 1 ? FIFO_POP_TIME : 0 };
+        }
+        spidev_udelay(FIFO_POP_TIME);
+        spidev_transfer_multi(ax->spi, count, xfers);
+        for (i=0; i<count; i++)
+            fifo_status = adxl_add_entry(ax, oid, msg[i]);
+    }
+    // Check fifo status
     if (fifo_status > 1 && fifo_status <= 32) {
         // More data in fifo - wake this task again
         sched_wake_task(&adxl345_wake);
@@ -185,7 +292,7 @@ command_query_adxl345(uint32_t *args)
     ax->rest_ticks = args[2];
     ax->flags = AX_HAVE_START;
     ax->sequence = ax->limit_count = 0;
-    ax->data_count = 0;
+    ax->data_count = ax->sample_count = ax->pred_count = 0;
     sched_add_timer(&ax->timer);
 }
 DECL_COMMAND(command_query_adxl345,
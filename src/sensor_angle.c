@@ -29,11 +29,14 @@ struct spi_angle {
     struct timer timer;
     uint32_t rest_ticks;
     struct spidev_s *spi;
-    uint16_t sequence;
+    uint16_t sequence, last_angle, last2_angle;
     uint8_t flags, chip_type, data_count, time_shift, overflow;
+    uint8_t encoding, sample_count, pred_count;
     uint8_t data[48];
 };
 
+enum { SA_ENCODING_RAW, SA_ENCODING_DELTA };
+
 enum {
     SA_PENDING = 1<<2,
 };
@@ -72,6 +75,17 @@ command_config_spi_angle(uint32_t *args)
 DECL_COMMAND(command_config_spi_angle,
              "config_spi_angle oid=%c spi_oid=%c spi_angle_type=%c");
 
+void
+command_set_spi_angle_encoding(uint32_t *args)
+{
+    struct spi_angle *sa = oid_lookup(args[0], command_config_spi_angle);
+    if (args[1] > SA_ENCODING_DELTA)
+        shutdown("Invalid spi_angle encoding");
+    sa->encoding = args[1];
+}
+DECL_COMMAND(command_set_spi_angle_encoding,
+             "set_spi_angle_encoding oid=%c encoding=%c");
+
 // Report local measurement buffer
 static void
 angle_report(struct spi_angle *sa, uint8_t oid)
@@ -79,21 +93,67 @@ angle_report(struct spi_angle *sa, uint8_t oid)
     sendf("spi_angle_data oid=%c sequence=%hu data=%*s"
           , oid, sa->sequence, sa->data_count, sa->data);
     sa->data_count = 0;
-    sa->sequence++;
+    if (sa->encoding == SA_ENCODING_DELTA) {
+        // In delta mode the sequence is the index of the first sample
+        sa->sequence += sa->sample_count;
+        sa->sample_count = sa->pred_count = 0;
+    } else {
+        sa->sequence++;
+    }
 }
 
 // Send spi_angle_data message if buffer is full
 static void
 angle_check_report(struct spi_angle *sa, uint8_t oid)
 {
-    if (sa->data_count + 3 > ARRAY_SIZE(sa->data))
+    // Delta encoded entries use at most 4 bytes
+    uint_fast8_t max_size = sa->encoding == SA_ENCODING_DELTA ? 4 : 3;
+    if (sa->data_count + max_size > ARRAY_SIZE(sa->data))
         angle_report(sa, oid);
 }
 
+// Add a delta encoded entry to the measurement buffer.  Angles are
+// stored as the zigzag varint encoded difference from a linear
+// prediction based on the previous two angles in this message.
+static void
+angle_add_delta(struct spi_angle *sa, uint_fast8_t tcode, uint_fast16_t data)
+{
+    uint8_t *d = &sa->data[sa->data_count];
+    *d++ = tcode;
+    sa->sample_count++;
+    if (tcode == TCODE_ERROR) {
+        *d++ = data;
+        sa->data_count = d - sa->data;
+        return;
+    }
+    uint16_t pred = 0, angle = data;
+    uint_fast8_t pred_count = sa->pred_count;
+    if (pred_count == 1)
+        pred = sa->last_angle;
+    else if (pred_count >= 2)
+        pred = 2 * sa->last_angle - sa->last2_angle;
+    uint16_t r = angle - pred;
+    uint_fast16_t z = (uint16_t)(r & 0x8000 ? ~(r << 1) : r << 1);
+    while (z >= 0x80) {
+        *d++ = z | 0x80;
+        z >>= 7;
+    }
+    *d++ = z;
+    sa->data_count = d - sa->data;
+    sa->last2_angle = sa->last_angle;
+    sa->last_angle = angle;
+    if (pred_count < 2)
+        sa->pred_count = pred_count + 1;
+}
+
 // Add an entry to the measurement buffer
 static void
 angle_add(struct spi_angle *sa, uint_fast8_t tcode, uint_fast16_t data)
 {
+    if (sa->encoding == SA_ENCODING_DELTA) {
+        angle_add_delta(sa, tcode, data);
+        return;
+    }
     sa->data[sa->data_count] = tcode;
     sa->data[sa->data_count + 1] = data;
     sa->data[sa->data_count + 2] = data >> 8;
@@ -144,17 +204,37 @@ static void
 as5047d_query(struct spi_angle *sa, uint32_t stime)
 {
     uint8_t msg[2] = { 0x7F, 0xFE };
-    uint32_t mtime1 = timer_read_time();
-    spidev_transfer(sa->spi, 0, sizeof(msg), msg);
-    uint32_t mtime2 = timer_read_time();
-    // Data is latched on CS pin rising after query request
-    if (mtime2 - mtime1 > MAX_SPI_READ_TIME) {
-        angle_add_error(sa, SE_SPI_TIME);
-        return;
+    uint32_t mtime1 = timer_read_time(), mtime2;
+    if (spidev_can_transfer_multi(sa->spi)) {
+        // Send query request and read response in one batch
+        uint8_t query[2] = { 0x7F, 0xFE };
+        msg[0] = 0xC0;
+        msg[1] = 0x00;
+        struct spidev_xfer xfers[2] = {
+            { .data = query, .len = sizeof(query) },
+            { .data = msg, .len = sizeof(msg), .receive_data = 1 },
+        };
+        spidev_transfer_multi(sa->spi, ARRAY_SIZE(xfers), xfers);
+        uint32_t mtime3 = timer_read_time();
+        // Data is latched on CS pin rising after query request (which is
+        // approximately half way through the two equal sized transfers)
+        if (mtime3 - mtime1 > 2 * MAX_SPI_READ_TIME) {
+            angle_add_error(sa, SE_SPI_TIME);
+            return;
+        }
+        mtime2 = mtime1 + (mtime3 - mtime1) / 2;
+    } else {
+        spidev_transfer(sa->spi, 0, sizeof(msg), msg);
+        mtime2 = timer_read_time();
+        // Data is latched on CS pin rising after query request
+        if (mtime2 - mtime1 > MAX_SPI_READ_TIME) {
+            angle_add_error(sa, SE_SPI_TIME);
+            return;
+        }
+        msg[0] = 0xC0;
+        msg[1] = 0x00;
+        spidev_transfer(sa->spi, 1, sizeof(msg), msg);
     }
-    msg[0] = 0xC0;
-    msg[1] = 0x00;
-    spidev_transfer(sa->spi, 1, sizeof(msg), msg);
     uint_fast8_t parity = msg[0] ^ msg[1];
     parity ^= parity >> 4;
     parity ^= parity >> 2;
@@ -182,15 +262,6 @@ crc8(uint8_t crc, uint8_t data)
     return crc;
 }
 
-// microsecond delay helper
-static inline void
-udelay(uint32_t usecs)
-{
-    uint32_t end = timer_read_time() + timer_from_us(usecs);
-    while (!timer_is_before(end, timer_read_time()))
-        irq_poll();
-}
-
 // tle5012b sensor query
 static void
 tle5012b_query(struct spi_angle *sa, uint32_t stime)
@@ -198,7 +269,7 @@ tle5012b_query(struct spi_angle *sa, uint32_t stime)
     struct gpio_out cs_pin = spidev_get_cs_pin(sa->spi);
     // Latch data (data is latched on rising CS of a NULL message)
     gpio_out_write(cs_pin, 0);
-    udelay(1);
+    spidev_udelay(1);
     irq_disable();
     gpio_out_write(cs_pin, 1);
     uint32_t mtime = timer_read_time();
@@ -241,7 +312,7 @@ command_query_spi_angle(uint32_t *args)
     sa->timer.waketime = args[1];
     sa->rest_ticks = args[2];
     sa->sequence = 0;
-    sa->data_count = 0;
+    sa->data_count = sa->sample_count = sa->pred_count = 0;
     sa->time_shift = args[3];
     sched_add_timer(&sa->timer);
 }
@@ -261,7 +332,7 @@ command_spi_angle_transfer(uint32_t *args)
         // Latch data (data is latched on rising CS of a NULL message)
         struct gpio_out cs_pin = spidev_get_cs_pin(sa->spi);
         gpio_out_write(cs_pin, 0);
-        udelay(1);
+        spidev_udelay(1);
         irq_disable();
         gpio_out_write(cs_pin, 1);
         mtime = timer_read_time();
@@ -0,0 +1,223 @@
+// Benchmarks of timer dispatch and command parsing
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <stddef.h> // offsetof
+#include <stdio.h> // printf
+#include <time.h> // clock_gettime
+#include "autoconf.h" // CONFIG_CLOCK_FREQ
+#include "board/misc.h" // timer_from_us
+#include "command.h" // command_parsef
+#include "compiler.h" // container_of
+#include "sched.h" // sched_add_timer
+
+static uint64_t
+bench_get_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if CONFIG_SIMULATOR_SCHED_BENCH
+
+#define BENCH_EVENTS 4000000
+#define BENCH_BUCKET_NS 10
+#define BENCH_BUCKETS 1000
+#define BENCH_DELETE_INTERVAL 1000
+
+struct bench_timer {
+    struct timer timer;
+    uint32_t interval, rand;
+};
+
+static struct bench_timer bench_timers[CONFIG_SIMULATOR_BENCH_STEPPERS + 4];
+static uint32_t bench_hist[BENCH_BUCKETS + 1];
+static uint32_t bench_wake_time, bench_early;
+
+// Reschedule a timer (with some pseudo random jitter)
+static uint_fast8_t
+bench_event(struct timer *t)
+{
+    struct bench_timer *bt = container_of(t, struct bench_timer, timer);
+    if (timer_is_before(bench_wake_time, t->waketime))
+        // Timer run before its waketime
+        bench_early++;
+    bt->rand = bt->rand * 1103515245 + 12345;
+    t->waketime += bt->interval + (bt->rand >> 16) % (bt->interval / 4 + 1);
+    return SF_RESCHEDULE;
+}
+
+// Report the dispatch time at the given percentile
+static uint32_t
+bench_percentile(uint32_t count, uint32_t per_mille)
+{
+    uint32_t limit = (uint64_t)count * per_mille / 1000, total = 0, i;
+    for (i = 0; i < BENCH_BUCKETS; i++) {
+        total += bench_hist[i];
+        if (total >= limit)
+            break;
+    }
+    return (i + 1) * BENCH_BUCKET_NS;
+}
+
+// Delete the next bench timer from outside of a timer callback (as
+// a task would) and add it again at a later time
+static void
+bench_delete_next(void)
+{
+    struct bench_timer *next = &bench_timers[0];
+    int i;
+    for (i = 1; i < ARRAY_SIZE(bench_timers); i++)
+        if (timer_is_before(bench_timers[i].timer.waketime
+                            , next->timer.waketime))
+            next = &bench_timers[i];
+    sched_del_timer(&next->timer);
+    next->timer.waketime += next->interval;
+    sched_add_timer(&next->timer);
+}
+
+// Run timers (in simulated time) and report the time spent in each
+// call to sched_timer_dispatch()
+void
+sched_bench(void)
+{
+    // Steppers running at 5K to 200K steps per second
+    int steppers = CONFIG_SIMULATOR_BENCH_STEPPERS, i;
+    for (i = 0; i < steppers; i++) {
+        struct bench_timer *bt = &bench_timers[i];
+        uint32_t rate = 5000 + i * (195000 / steppers);
+        bt->interval = CONFIG_CLOCK_FREQ / rate;
+        bt->rand = i;
+    }
+    // Other periodic timers (endstop, adc, sensor, and pwm)
+    static const uint32_t other_us[] = { 100, 1000, 2500, 10000 };
+    for (i = 0; i < 4; i++)
+        bench_timers[steppers + i].interval = timer_from_us(other_us[i]);
+    for (i = 0; i < steppers + 4; i++) {
+        struct bench_timer *bt = &bench_timers[i];
+        bt->timer.func = bench_event;
+        bt->timer.waketime = timer_from_us(1000) + i;
+        sched_add_timer(&bt->timer);
+    }
+
+    // Dispatch timers
+    uint64_t total_ns = 0, max_ns = 0;
+    uint32_t count;
+    bench_wake_time = timer_from_us(1000);
+    for (count = 0; count < BENCH_EVENTS; count++) {
+        if (count % BENCH_DELETE_INTERVAL == BENCH_DELETE_INTERVAL - 1)
+            bench_delete_next();
+        uint64_t start = bench_get_ns();
+        bench_wake_time = sched_timer_dispatch();
+        uint64_t ns = bench_get_ns() - start;
+        total_ns += ns;
+        if (ns > max_ns)
+            max_ns = ns;
+        uint32_t bucket = ns / BENCH_BUCKET_NS;
+        bench_hist[bucket < BENCH_BUCKETS ? bucket : BENCH_BUCKETS]++;
+    }
+
+    // Measure overhead of the time measurement itself
+    uint64_t overhead_ns = bench_get_ns();
+    for (i = 0; i < 1000; i++)
+        bench_get_ns();
+    overhead_ns = (bench_get_ns() - overhead_ns) / 1000;
+
+    printf("timer %s with %d steppers and 4 other timers\n"
+           , CONFIG_SCHED_TIMER_HEAP ? "heap" : "list", steppers);
+    printf("dispatches=%u avg=%uns p99=%uns p99.9=%uns max=%uns"
+           " (timing overhead %uns)\n"
+           , count, (uint32_t)(total_ns / count)
+           , bench_percentile(count, 990), bench_percentile(count, 999)
+           , (uint32_t)max_ns, (uint32_t)overhead_ns);
+    printf("deletes of next timer=%u timers run early=%u\n"
+           , count / BENCH_DELETE_INTERVAL, bench_early);
+}
+
+#endif // CONFIG_SIMULATOR_SCHED_BENCH
+
+#if CONFIG_SIMULATOR_PARSE_BENCH
+
+#define BENCH_COMMANDS 1000
+#define BENCH_ROUNDS 10000
+
+static uint8_t bench_buf[BENCH_COMMANDS * 16];
+
+// Encode an integer as a "variable length quantity"
+static uint8_t *
+bench_encode_int(uint8_t *p, uint32_t v)
+{
+    int32_t sv = v;
+    if (sv < (3L<<5)  && sv >= -(1L<<5))  goto f4;
+    if (sv < (3L<<12) && sv >= -(1L<<12)) goto f3;
+    if (sv < (3L<<19) && sv >= -(1L<<19)) goto f2;
+    if (sv < (3L<<26) && sv >= -(1L<<26)) goto f1;
+    *p++ = (v>>28) | 0x80;
+f1: *p++ = ((v>>21) & 0x7f) | 0x80;
+f2: *p++ = ((v>>14) & 0x7f) | 0x80;
+f3: *p++ = ((v>>7) & 0x7f) | 0x80;
+f4: *p++ = v & 0x7f;
+    return p;
+}
+
+// Parse a block of queue_step commands and report the time spent
+static void
+bench_parse(const struct command_parser *cp, uint8_t *end, int generic)
+{
+    uint32_t args[8];
+    uint64_t start = bench_get_ns();
+    int i;
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        uint8_t *p = bench_buf;
+        while (p < end) {
+            p++;
+            if (generic)
+                p = command_parsef(p, end, cp, args);
+            else
+                p = cp->parse(p, end, args);
+        }
+    }
+    uint64_t ns = bench_get_ns() - start;
+    uint32_t avg_ps = ns * 1000 / ((uint64_t)BENCH_ROUNDS * BENCH_COMMANDS);
+    printf("%s parser: avg=%u.%03uns\n", generic ? "generic" : "specialized"
+           , avg_ps / 1000, avg_ps % 1000);
+}
+
+extern void command_queue_step(uint32_t *args);
+
+// Compare the generic and generated parsers on queue_step commands
+void
+parse_bench(void)
+{
+    const struct command_parser *cp = NULL;
+    int i;
+    for (i = 0; i < command_index_size; i++)
+        if (command_index[i].func == command_queue_step)
+            cp = &command_index[i];
+    if (!cp || !cp->parse) {
+        printf("queue_step parser not found\n");
+        return;
+    }
+
+    // Typical queue_step parameters (oid, interval, count, add)
+    uint32_t rand = 1;
+    uint8_t *p = bench_buf;
+    for (i = 0; i < BENCH_COMMANDS; i++) {
+        rand = rand * 1103515245 + 12345;
+        *p++ = cp->msg_id;
+        p = bench_encode_int(p, i % 4);
+        p = bench_encode_int(p, 200 + (rand >> 16) % 50000);
+        p = bench_encode_int(p, 1 + (rand >> 8) % 300);
+        p = bench_encode_int(p, (int32_t)((rand >> 4) % 101) - 50);
+    }
+
+    printf("time to parse one queue_step command (%u commands)\n"
+           , BENCH_ROUNDS * BENCH_COMMANDS);
+    bench_parse(cp, p, 1);
+    bench_parse(cp, p, 0);
+}
+
+#endif // CONFIG_SIMULATOR_PARSE_BENCH
@@ -4,12 +4,24 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include "autoconf.h" // CONFIG_SIMULATOR_SCHED_BENCH
 #include "sched.h" // sched_main
 
+void sched_bench(void);
+void parse_bench(void);
+
 // Main entry point for simulator.
 int
 main(void)
 {
+    if (CONFIG_SIMULATOR_SCHED_BENCH) {
+        sched_bench();
+        return 0;
+    }
+    if (CONFIG_SIMULATOR_PARSE_BENCH) {
+        parse_bench();
+        return 0;
+    }
     sched_main();
     return 0;
 }
@@ -7,6 +7,8 @@
 #include <string.h> // memcpy
 #include "autoconf.h" // CONFIG_HAVE_GPIO_BITBANGING
 #include "board/gpio.h" // gpio_out_write
+#include "board/irq.h" // irq_poll
+#include "board/misc.h" // timer_read_time
 #include "basecmd.h" // oid_alloc
 #include "command.h" // DECL_COMMAND
 #include "sched.h" // DECL_SHUTDOWN
@@ -109,6 +111,47 @@ spidev_transfer(struct spidev_s *spi, uint8_t receive_data
         gpio_out_write(spi->pin, !(flags & SF_CS_ACTIVE_HIGH));
 }
 
+// Busy wait for the given number of microseconds (while still
+// processing irqs) - for chip select and device timing requirements
+void
+spidev_udelay(uint32_t usecs)
+{
+    uint32_t end = timer_read_time() + timer_from_us(usecs);
+    while (!timer_is_before(end, timer_read_time()))
+        irq_poll();
+}
+
+// Check if spidev_transfer_multi() submits all transfers at once
+int
+spidev_can_transfer_multi(struct spidev_s *spi)
+{
+    return (CONFIG_HAVE_GPIO_SPI_MULTI
+            && ((spi->flags & (SF_HAVE_PIN|SF_SOFTWARE|SF_HARDWARE))
+                == SF_HARDWARE));
+}
+
+// Perform several transfers (releasing chip select between each).
+// Boards that can queue the transfers are given them all at once.
+void
+spidev_transfer_multi(struct spidev_s *spi, uint8_t count
+                      , struct spidev_xfer *xfers)
+{
+#if CONFIG_HAVE_GPIO_SPI_MULTI
+    if (spidev_can_transfer_multi(spi)) {
+        spi_prepare(spi->spi_config);
+        spi_transfer_multi(spi->spi_config, count, xfers);
+        return;
+    }
+#endif
+    uint_fast8_t i;
+    for (i=0; i<count; i++) {
+        struct spidev_xfer *x = &xfers[i];
+        spidev_transfer(spi, x->receive_data, x->len, x->data);
+        if (x->delay_us)
+            spidev_udelay(x->delay_us);
+    }
+}
+
 void
 command_spi_transfer(uint32_t *args)
 {
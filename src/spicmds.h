@@ -8,7 +8,15 @@ struct spi_software;
 void spidev_set_software_bus(struct spidev_s *spi, struct spi_software *ss);
 int spidev_have_cs_pin(struct spidev_s *spi);
 struct gpio_out spidev_get_cs_pin(struct spidev_s *spi);
+void spidev_udelay(uint32_t usecs);
 void spidev_transfer(struct spidev_s *spi, uint8_t receive_data
                      , uint8_t data_len, uint8_t *data);
+struct spidev_xfer {
+    uint8_t *data;
+    uint8_t len, receive_data, delay_us;
+};
+int spidev_can_transfer_multi(struct spidev_s *spi);
+void spidev_transfer_multi(struct spidev_s *spi, uint8_t count
+                           , struct spidev_xfer *xfers);
 
 #endif // spicmds.h
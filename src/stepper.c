@@ -39,6 +39,13 @@ struct stepper_move {
 
 enum { MF_DIR=1<<0 };
 
+// Additional step/dir pins that follow the steps of a stepper
+struct stepper_group_pins {
+    struct stepper_group_pins *next;
+    struct gpio_out step_pin, dir_pin;
+    uint8_t invert_step, invert_dir;
+};
+
 struct stepper {
     struct timer time;
     uint32_t interval;
@@ -46,6 +53,7 @@ struct stepper {
     uint32_t count;
     uint32_t next_step_time, step_pulse_ticks;
     struct gpio_out step_pin, dir_pin;
+    struct stepper_group_pins *group;
     uint32_t position;
     struct move_queue_head mq;
     struct trsync_signal stop_signal;
@@ -60,6 +68,24 @@ enum {
     SF_SINGLE_SCHED=1<<4, SF_HAVE_ADD=1<<5
 };
 
+// Toggle the step pins of all grouped steppers
+static void
+stepper_group_step(struct stepper *s)
+{
+    struct stepper_group_pins *gp;
+    for (gp = s->group; gp; gp = gp->next)
+        gpio_out_toggle_noirq(gp->step_pin);
+}
+
+// Toggle the dir pins of all grouped steppers
+static void
+stepper_group_dir(struct stepper *s)
+{
+    struct stepper_group_pins *gp;
+    for (gp = s->group; gp; gp = gp->next)
+        gpio_out_toggle_noirq(gp->dir_pin);
+}
+
 // Setup a stepper for the next move in its queue
 static uint_fast8_t
 stepper_load_next(struct stepper *s)
@@ -91,6 +117,8 @@ stepper_load_next(struct stepper *s)
     if (m->flags & MF_DIR) {
         s->position = -s->position + m->count;
         gpio_out_toggle_noirq(s->dir_pin);
+        if (unlikely(s->group))
+            stepper_group_dir(s);
     } else {
         s->position += m->count;
     }
@@ -105,6 +133,8 @@ stepper_event_edge(struct timer *t)
 {
     struct stepper *s = container_of(t, struct stepper, time);
     gpio_out_toggle_noirq(s->step_pin);
+    if (unlikely(s->group))
+        stepper_group_step(s);
     uint32_t count = s->count - 1;
     if (likely(count)) {
         s->count = count;
@@ -123,17 +153,23 @@ stepper_event_avr(struct timer *t)
 {
     struct stepper *s = container_of(t, struct stepper, time);
     gpio_out_toggle_noirq(s->step_pin);
+    if (unlikely(s->group))
+        stepper_group_step(s);
     uint16_t *pcount = (void*)&s->count, count = *pcount - 1;
     if (likely(count)) {
         *pcount = count;
         s->time.waketime += s->interval;
         gpio_out_toggle_noirq(s->step_pin);
+        if (unlikely(s->group))
+            stepper_group_step(s);
         if (s->flags & SF_HAVE_ADD)
             s->interval += s->add;
         return SF_RESCHEDULE;
     }
     uint_fast8_t ret = stepper_load_next(s);
     gpio_out_toggle_noirq(s->step_pin);
+    if (unlikely(s->group))
+        stepper_group_step(s);
     return ret;
 }
 
@@ -143,6 +179,8 @@ stepper_event_full(struct timer *t)
 {
     struct stepper *s = container_of(t, struct stepper, time);
     gpio_out_toggle_noirq(s->step_pin);
+    if (unlikely(s->group))
+        stepper_group_step(s);
     uint32_t curtime = timer_read_time();
     uint32_t min_next_time = curtime + s->step_pulse_ticks;
     s->count--;
@@ -216,6 +254,25 @@ stepper_oid_lookup(uint8_t oid)
     return oid_lookup(oid, command_config_stepper);
 }
 
+// Add a step and dir pin that are stepped along with the given stepper
+void
+command_stepper_group_add_pins(uint32_t *args)
+{
+    struct stepper *s = stepper_oid_lookup(args[0]);
+    struct stepper_group_pins *gp = alloc_chunk(sizeof(*gp));
+    gp->invert_step = args[3];
+    gp->invert_dir = args[4];
+    gp->step_pin = gpio_out_setup(args[1], gp->invert_step);
+    gp->dir_pin = gpio_out_setup(args[2], gp->invert_dir);
+    irq_disable();
+    gp->next = s->group;
+    s->group = gp;
+    irq_enable();
+}
+DECL_COMMAND(command_stepper_group_add_pins,
+             "stepper_group_add_pins oid=%c step_pin=%c dir_pin=%c"
+             " invert_step=%c invert_dir=%c");
+
 // Schedule a set of steps with a given timing
 void
 command_queue_step(uint32_t *args)
@@ -318,8 +375,16 @@ stepper_stop(struct trsync_signal *tss, uint8_t reason)
     s->count = 0;
     s->flags = (s->flags & (SF_INVERT_STEP|SF_SINGLE_SCHED)) | SF_NEED_RESET;
     gpio_out_write(s->dir_pin, 0);
-    if (!(HAVE_EDGE_OPTIMIZATION && s->flags & SF_SINGLE_SCHED))
+    uint_fast8_t reset_step = !(HAVE_EDGE_OPTIMIZATION
+                                && s->flags & SF_SINGLE_SCHED);
+    if (reset_step)
         gpio_out_write(s->step_pin, s->flags & SF_INVERT_STEP);
+    struct stepper_group_pins *gp;
+    for (gp = s->group; gp; gp = gp->next) {
+        gpio_out_write(gp->dir_pin, gp->invert_dir);
+        if (reset_step)
+            gpio_out_write(gp->step_pin, gp->invert_step);
+    }
     while (!move_queue_empty(&s->mq)) {
         struct move_node *mn = move_queue_pop(&s->mq);
         struct stepper_move *m = container_of(mn, struct stepper_move, node);